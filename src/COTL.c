@@ -1,23 +1,159 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_ttf.h>
+#ifndef COTL_PROFILE
+#define COTL_PROFILE 1  // build with -DCOTL_PROFILE=0 to compile the profiler zones out
+#endif
 #include <stdbool.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define COTL_SSE2 1
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define COTL_AVX2 1
+#endif
+#ifdef _WIN32
+#include <winsock2.h>  // must come before windows.h
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#endif
 
 #define INITIAL_SCREEN_WIDTH 800
 #define INITIAL_SCREEN_HEIGHT 600
+#define WORLD_WIDTH 800   // the simulation's fixed coordinate space, whatever the window size
+#define WORLD_HEIGHT 600
 #define PLAYER_SIZE 40
 #define PLAYER_MAX_HP 15
 #define ENEMY_SIZE 30
 #define CIRCLE_RADIUS 50
 #define RED_DOT_RADIUS 5
 #define ENEMY_COUNT 10
+#define MAX_WAVE_DEFINITIONS 16
+#define WAVE_SPAWN_TICKS 30        // a wave enters over this many ticks unless --waves says otherwise
+#define SPAWN_SAFE_RADIUS 150.0f   // no enemy appears closer than this to the player's center
+#define SPAWN_MIN_SPACING 8.0f
+#define SPAWN_ATTEMPTS 30
+#define SPAWN_MAX_PER_TICK 2000    // larger waves take longer to enter rather than stall a tick
 #define SPEED 150
 #define INITIAL_ENEMY_SPEED 80.00
 #define PI 3.14159265358979323846
 #define MAX_BULLETS 9
+#define BULLET_SPEED 300.0f
+#define SIM_TICK_RATE 60
+#define MAX_FRAME_TIME 0.25
+#define MAX_QUEUED_SHOTS 8
+#define MAX_INPUT_STAMPS 16   // input events waiting for the frame that shows them
+#define LATENCY_SAMPLES 4096  // newest input-to-present latencies kept for the percentiles
+#define GRID_CELL_SIZE 64
+#define GRID_CHECK_SEEDS 8       // seeds played by --verify-grid, from --seed on
+#define GRID_CHECK_TICKS 3600     // per session
+#define GRID_CHECK_HORDE 1000     // enemies per wave in the second session of each seed
+#define FLOW_CELL_SIZE 20
+#define FLOW_STRAIGHT_COST 10
+#define FLOW_DIAGONAL_COST 14
+#define SEPARATION_RADIUS 30.0f
+#define SEPARATION_WEIGHT 1.5f
+#define SEPARATION_MAX_NEIGHBORS 6
+#define SEPARATION_MAX_CHECKS 16   // bounds the cost per enemy inside dense crowds
+#define MAX_WORKERS 15
+#define JOB_QUEUE_SIZE 256      // jobs per worker queue, must be a power of two
+#define ENEMY_JOB_GRAIN 4096    // a multiple of 8 so every job starts on a SIMD boundary
+#define STEER_JOB_GRAIN 1024
+#define BULLET_JOB_GRAIN 64
+#define BULLET_SIZE 10
+#define SPRITE_WHITE_SIZE 4
+#define MAX_PARTICLES 100000       // live particles per blend mode
+#define PARTICLE_FRAME_BUDGET 4096 // new particles per frame, however much happens in it
+#define PARTICLE_BURST 12          // per kill, split between debris and sparks
+#define PARTICLE_TRAIL_RATE 240.0f // fireball trail particles per second
+#define PARTICLE_DRAG 4.0f         // velocity lost per second, as an exponential rate
+#define PARTICLE_SIZE 3
+#define MAX_KILL_EVENTS 1024       // kills one frame can hand to the renderer
+#define REPLAY_MAGIC 0x4C505243u   // "CRPL"
+#define REPLAY_VERSION 1
+#define REPLAY_MAX_RECORD 24
+#define REPLAY_AIM_SCALE 8         // clicks land on 1/8 pixel steps, which replays store compactly
+#define REPLAY_MAX_SETTING 1000000 // largest wave size, bullet limit or spawn time a replay may ask for
+#define AUDIO_FREQUENCY 48000
+#define AUDIO_BUFFER_FRAMES 256    // 5.3 ms per callback at 48 kHz
+#define AUDIO_VOICES 32
+#define AUDIO_QUEUE_SIZE 256       // commands in flight, must be a power of two
+#define AUDIO_MASTER_VOLUME 0.5f
+#define AUDIO_KILL_SOUNDS 4        // kill sounds started per frame, however many enemies die
+#define PACER_SPIN_MS 2
+#define IDLE_WAIT_MS 500
+#define RENDER_SCALE_MIN 0.5f
+#define RENDER_SCALE_STEP_DOWN 0.85f
+#define RENDER_SCALE_STEP_UP 1.1f
+#define RENDER_SCALE_SETTLE_MS 1000  // minimum time between two scale changes
+#define RENDER_SCALE_RAISE_MS 3000   // time within budget before scaling back up
+#define DIRTY_TILE_SIZE 16           // window pixels per side of a tile redrawn on the software path
+#define DIRTY_PADDING 2              // pixels added around sprites for filtering and rounding
+#define PROFILE_RING_SIZE 65536  // must be a power of two
+#define PROFILE_HISTORY 180
+#define PROFILE_GRAPH_HEIGHT 80
+#define PROFILE_LABEL_REFRESH_MS 250
+#define GLYPH_FIRST 32
+#define GLYPH_LAST 126
+#define GLYPH_COUNT (GLYPH_LAST - GLYPH_FIRST + 1)
+#define GLYPH_ATLAS_MAX_WIDTH 1024
+#define MAX_LABEL_LENGTH 64
+#define LEADERBOARD_SIZE 10
+#define SCORE_FILE "highscore.dat"
+#define SCORE_FILE_TEMP "highscore.dat.tmp"
+#define SCORE_FILE_MAGIC 0x4C544F43 // "COTL"
+#define SCORE_FILE_VERSION 1
+#define SCORE_FILE_HEADER_SIZE 12
+#define SCORE_ENTRY_SIZE 12
+#define SCORE_FILE_MAX_SIZE (SCORE_FILE_HEADER_SIZE + LEADERBOARD_SIZE * SCORE_ENTRY_SIZE + 4)
+#define BUNDLE_FILE "./assets/cotl.pak"
+#define BUNDLE_MAGIC 0x4B415043 // "CPAK"
+#define BUNDLE_VERSION 1
+#define BUNDLE_HEADER_SIZE 16
+#define BUNDLE_ENTRY_SIZE 72
+#define BUNDLE_NAME_LENGTH 32
+#define BUNDLE_MAX_ENTRIES 16
+#define BUNDLE_ALIGNMENT 16
+#define BUNDLE_FONT_NAME "font"
+#define LZ4_MIN_MATCH 4
+#define FRAME_ARENA_SIZE (256 * 1024)
+#define FRAME_ARENA_ALIGNMENT 16
+#define ALLOC_CHECK_WARMUP_FRAMES 120  // frames exempt after a game starts or something is rebuilt
+#define ALLOC_CHECK_MAX_REPORTS 10
+#define NET_PROTOCOL_VERSION 1
+#define NET_MAX_PACKET 1200        // every packet, snapshots included, stays under a typical path MTU
+#define NET_MAX_ENTITIES 4096      // enemies or bullets a snapshot can describe
+#define NET_VIEW_HISTORY 32        // snapshots kept as delta baselines, must be a power of two
+#define NET_INPUT_HISTORY 64       // must be a power of two
+#define NET_INPUT_REDUNDANCY 8     // unacknowledged inputs repeated in every input packet
+#define NET_INPUT_BACKLOG 8        // queued inputs the server lets build up before dropping some
+#define NET_DELAY_QUEUE 512
+#define NET_CONNECT_RETRY_MS 250
+#define NET_TIMEOUT_MS 3000
+#define NET_CONNECT_SIZE 9
+#define NET_INPUT_HEADER 10
+#define NET_SNAPSHOT_HEADER 13
+#define NET_POSITION_SCALE 8       // positions travel in 1/8 pixel steps
+#define NET_POSITION_OFFSET 4096   // and may reach 512 pixels past the top or left edge
+#define NET_ANGLE_BITS 12
+#define NET_SMALL_DELTA_BITS 6
+#define NET_MEDIUM_DELTA_BITS 11
+#define NET_ENTITY_MAX_BITS 34     // a 2-bit tag and two absolute positions
+#define NET_CORRECTION_EPSILON 0.5f
 
 typedef struct {
     float x, y;
@@ -26,22 +162,808 @@ typedef struct {
     int hp;  
 } Entity;
 
+// Live projectiles packed in [0, count). Spawning appends at count and
+// removal swaps the last bullet into the hole, so both are O(1) and the
+// unused tail acts as the free list.
 typedef struct {
-    float x, y;
+    float* x;
+    float* y;
+    float* vx;
+    float* vy;
+    int* hit;  // scratch: enemy each bullet hits this tick, -1 for none
+    int count;
+    int capacity;
+} BulletPool;
+
+enum {
+    INPUT_UP = 1 << 0,
+    INPUT_DOWN = 1 << 1,
+    INPUT_LEFT = 1 << 2,
+    INPUT_RIGHT = 1 << 3
+};
+
+// Everything the player can do during one simulation tick.
+typedef struct {
+    Uint8 move;  // INPUT_* bits
+    bool fire;
+    float fireX, fireY;
+} SimInput;
+
+typedef struct {
+    Uint64 state;
+} Rng;
+
+typedef struct {
+    int count;
+    int spawnTicks;  // the wave is spread evenly over this many ticks
+} WaveDefinition;
+
+// Queues each wave and lets it into the world a slice per tick, so a big
+// wave never lands in a single tick.
+typedef struct {
+    int wave;      // counts from 0
+    int queued;    // enemies of this wave still to place
+    int perTick;
+    float spacing; // minimum distance between enemies of this wave, 0 once the world is full
+} WaveDirector;
+
+// Live enemies stored as parallel arrays. Enemies killed during a tick are
+// only flagged; removeDeadEnemies() swap-removes them so [0, count) stays dense.
+typedef struct {
+    float* x;
+    float* y;
+    float* steerX;  // scratch: heading for this tick, any length
+    float* steerY;
+    bool* alive;
+    int count;
+    int capacity;
+} EnemyPool;
+
+// Where enemies died, collected for the renderer's particle bursts. Once it
+// is full further kills go unreported; they only lose their effect.
+typedef struct {
+    float x[MAX_KILL_EVENTS];
+    float y[MAX_KILL_EVENTS];
+    int count;
+} KillEvents;
+
+// When input events happened, in performance counts, carried along with the
+// input until the first frame that shows its effect is presented. Events
+// past the capacity are not measured.
+typedef struct {
+    Uint64 times[MAX_INPUT_STAMPS];
+    int count;
+} InputStamps;
+
+// Per-game simulation state. Together with the score, enemy speed and
+// bullet globals this is everything simStep() reads and writes.
+typedef struct {
+    Entity player;
+    EnemyPool enemies;
+    float angle;
+    float redDotX, redDotY;
+    Uint32 tick;
+    int damageCooldown;  // ticks until the player can be hurt again
+    WaveDirector waves;
+    Rng rng;
+    KillEvents kills;  // since the last captureSnapshot()
+    int volleys;       // shots that fired bullets, since the last captureSnapshot()
+} World;
+
+// What the renderer needs from one simulated frame, copied out of the World
+// so it can be drawn while the next frame is being simulated.
+typedef struct {
+    Entity player;
+    float redDotX, redDotY;
+    int score;
+    float* enemyX;
+    float* enemyY;
+    int enemyCount;
+    int enemyCapacity;
+    float* bulletX;
+    float* bulletY;
+    int bulletCount;
+    int bulletCapacity;
+    KillEvents kills;
+    int volleys;
+    InputStamps inputs;  // input first taken by the ticks of this frame
+} WorldSnapshot;
+
+// Runs the simulation on its own thread one frame ahead of the renderer: it
+// fills the back snapshot while the main thread draws the front one, and
+// the two are swapped once both are done. Without a thread every frame is
+// simulated inline. The main thread only touches the inputs and the World
+// between finishSimFrame() and the next kickSimFrame().
+typedef struct {
+    World* world;
+    SDL_Thread* thread;
+    SDL_sem* start;
+    SDL_sem* done;
+    bool quit;
+    Uint8 move;
+    InputStamps moveStamps;  // key events not yet taken by a tick
+    SimInput shots[MAX_QUEUED_SHOTS];
+    Uint64 shotStamps[MAX_QUEUED_SHOTS];
+    int queuedShots;
+    double accumulator;
+    bool replaying;  // ticks take their input from the replay instead
+    bool endedGame;  // the last frame finished the game
+    WorldSnapshot snapshots[2];
+    int front;
+} SimPipeline;
+
+// Uniform grid over the screen, stored as one index array sorted by cell
+// (cellStart[c] .. cellStart[c + 1]). Rebuilt every tick.
+typedef struct {
+    int cols, rows;
+    float margin;  // largest half size of anything inserted
+    int* cellStart;
+    int* cellFill;
+    int cellCapacity;
+    int* items;
+    float* itemX;  // centers in items order, for scans that only need positions
+    float* itemY;
+    int* itemCell;
+    int* results;  // scratch space for query results
+    int itemCapacity;
+} SpatialGrid;
+
+// Counts for --verify-grid.
+typedef struct {
+    Uint64 queries;
+    Uint64 mismatches;
+} GridCheck;
+
+// Headings towards the player over a coarse grid, from a Dijkstra search
+// out of the player's cell. It is only rebuilt when the player enters
+// another cell, and every enemy looks its heading up instead of steering
+// on its own. Blocked cells are routed around.
+typedef struct {
+    int cols, rows;
+    int goalCell;  // -1 until the first build
+    Uint8* blocked;
+    int* distance;
+    float* dirX;
+    float* dirY;
+    Sint64* heap;  // pending cells keyed by distance << 32 | cell
+} FlowField;
+
+// Background grid for Poisson-disk dart throwing. Cells are spacing / sqrt(2)
+// wide, so each holds at most one accepted point and a candidate only has
+// to be checked against the 5x5 cells around it.
+typedef struct {
+    float cellSize;
+    int cols, rows;
+    float* pointX;
+    float* pointY;
+    Uint8* used;
+    int capacity;
+} SpawnGrid;
+
+typedef void (*JobFunction)(void* data, int begin, int end, int worker);
+
+typedef struct {
+    JobFunction function;
+    void* data;
+    int begin, end;
+} Job;
+
+// Each worker pops its own jobs from the back and steals from the front of
+// the others' queues. Queues only hold a handful of jobs per batch, so a
+// spinlock each is enough.
+typedef struct {
+    Job jobs[JOB_QUEUE_SIZE];
+    Uint32 head, tail;
+    SDL_SpinLock lock;
+} JobQueue;
+
+// Worker threads for parallelFor(). One thread submits at a time and helps
+// until its batch is done; it runs as worker index workerCount.
+typedef struct {
+    int workerCount;
+    SDL_Thread* threads[MAX_WORKERS];
+    JobQueue queues[MAX_WORKERS];
+    SDL_sem* wake;
+    SDL_sem* done;  // posted by whichever thread finishes a batch's last job
+    SDL_atomic_t pending;
+    SDL_atomic_t quit;
+    int* scratch[MAX_WORKERS + 1];  // per-worker grid query results
+    int scratchCapacity;
+} JobSystem;
+
+// Bump allocator for data that only lives until the end of the frame, reset
+// as a whole by frameArenaReset(). Main thread only. Requests that do not fit
+// still succeed from the heap, which the allocation check then reports.
+typedef struct {
+    Uint8* base;
+    size_t size;
+    size_t used;
+    size_t peak;
+    void* overflow;  // heap blocks handed out when full, chained through their first word
+} FrameArena;
+
+// Every allocation the game makes goes through SDL, and so do SDL_image's
+// and SDL_ttf's, so counting SDL's allocator counts all of them. Workers
+// allocate too, hence the atomics.
+typedef struct {
+    SDL_malloc_func baseMalloc;
+    SDL_calloc_func baseCalloc;
+    SDL_realloc_func baseRealloc;
+    SDL_free_func baseFree;
+    SDL_atomic_t allocations;  // malloc, calloc and realloc calls
+    SDL_atomic_t frees;
+    SDL_atomic_t bytes;        // requested; wraps, so only differences mean anything
+} AllocCounter;
+
+// --alloc-check: once warmed up, every frame or headless tick that
+// allocated is reported and the process exits with status 1.
+typedef struct {
+    bool skipFrame;
+    int warmup;  // frames still exempt
+    int lastCount;
+    Uint64 frames;
+    Uint64 failures;
+} AllocCheck;
+
+#ifdef _WIN32
+typedef SOCKET NetSocket;
+#else
+typedef int NetSocket;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+
+enum {
+    PACKET_CONNECT = 1,
+    PACKET_INPUT,
+    PACKET_SNAPSHOT,
+    PACKET_DISCONNECT
+};
+
+enum {
+    NET_ENEMIES,
+    NET_BULLETS,
+    NET_GROUP_COUNT
+};
+
+// Bits are packed least significant first. Reading or writing past the end
+// sets overflow instead of touching memory.
+typedef struct {
+    Uint8* data;
+    int size;  // in bits
+    int bit;
+    bool overflow;
+} BitStream;
+
+typedef struct {
+    Uint32 deliverAt;  // SDL_GetTicks() time
+    struct sockaddr_in to;
+    int length;
+    Uint8 data[NET_MAX_PACKET];
+} DelayedPacket;
+
+// A non-blocking UDP socket behind the latency, jitter and loss simulator.
+// Only outgoing packets are delayed or dropped, so with both ends set up
+// the same way the round trip gets twice the latency.
+typedef struct {
+    NetSocket socket;
+    Rng rng;
+    DelayedPacket* delayed;
+    int delayedCount;
+    Uint64 bytesSent, bytesReceived;
+    Uint32 packetsSent, packetsReceived, packetsDropped;
+} NetLink;
+
+// Quantized positions of one kind of entity, see quantizePosition().
+typedef struct {
+    int count;
+    Uint16 x[NET_MAX_ENTITIES];
+    Uint16 y[NET_MAX_ENTITIES];
+} NetGroup;
+
+// What the client knows after one server tick. Both ends keep the last
+// NET_VIEW_HISTORY views: a snapshot is a delta against the newest view the
+// client acknowledged, and the client rebuilds it from its copy of that view.
+// Entities that did not fit into a snapshot keep their baseline positions.
+typedef struct {
+    Uint32 tick;       // 0 for an unused slot, server ticks start at 1
+    Uint32 lastInput;  // newest client input the server had applied
+    Uint16 playerX, playerY;
+    Uint16 angle;
+    int hp;
+    int score;
+    bool gameOver;
+    NetGroup groups[NET_GROUP_COUNT];
+} NetView;
+
+typedef struct {
+    Uint32 seq;  // 0 for an unused slot, inputs count from 1
+    SimInput input;
+    float predictedX, predictedY;  // client only: the player's position after this input
+} NetInput;
+
+// Authoritative end of a game with one remote player.
+typedef struct {
+    NetLink link;
+    struct sockaddr_in peer;
+    bool connected;
+    Uint32 lastHeard;
+    NetView* views;
+    Uint32 tick;
+    Uint32 ackedTick;
+    NetInput inputs[NET_INPUT_HISTORY];
+    Uint32 nextInput;
+    Uint32 newestInput;
+    Uint32 lastInput;
+    Uint8 lastMove;  // repeated while the next input is late
+    int cursors[NET_GROUP_COUNT];  // where the next snapshot resumes when not everything fit
+    Uint32 snapshots;
+    Uint64 snapshotBytes;
+    int largestSnapshot;
+} NetServer;
+
+// Predicts the local player from its own inputs and shows everything else
+// at the newest position received.
+typedef struct {
+    NetLink link;
+    struct sockaddr_in server;
+    bool connected;  // a first snapshot arrived
+    Uint32 lastConnect;
+    NetView* views;
+    NetView* scratch;  // decoding target, so a bad packet never touches the views
+    Uint32 newestTick;
+    NetInput inputs[NET_INPUT_HISTORY];
+    Uint32 inputSeq;
+    Uint32 appliedInput;  // newest input the server confirmed
+    Entity player;
     float angle;
-    bool active;
-} Bullet;
+    int score;
+    bool gameOver;
+    NetGroup shown[NET_GROUP_COUNT];
+    Uint32 shownTick[NET_GROUP_COUNT][NET_MAX_ENTITIES];  // snapshot each shown position came from
+    Uint32 firstTick;
+    Uint32 snapshots;
+    Uint64 snapshotBytes;
+    Uint32 reconciliations;
+    Uint32 corrections;
+    float largestCorrection;
+} NetClient;
+
+typedef struct {
+    bool headless;
+    bool showStats;
+    const char* tracePath;
+    bool vsync;
+    int fpsCap;
+    int renderScale;  // percent, 0 adjusts it automatically
+    int threads;      // 0 uses every core
+    Uint64 seed;
+    Uint64 ticks;
+    int waveSize;
+    WaveDefinition waves[MAX_WAVE_DEFINITIONS];  // the last one repeats, none means waveSize every wave
+    int waveCount;
+    int bulletLimit;
+    bool allocCheck;
+    bool verifyGrid;             // check every grid query against brute force
+    int serverPort;              // nonzero runs a headless server
+    const char* connectAddress;  // HOST:PORT of a server to play on
+    int netLatency;              // ms added to every packet sent
+    int netJitter;               // up to this many more ms, at random
+    float netLoss;               // percent of packets dropped on sending
+    const char* recordPath;      // writes the input of every game played
+    const char* replayPath;      // plays recorded games instead of reading input
+    bool mute;
+    bool fullRedraw;             // redraw the whole window every frame on the software renderer too
+    bool lateInput;              // re-read the movement keys just before presenting
+} Options;
+
+enum {
+    REPLAY_RUN,   // ticks with the same move bits and no shot
+    REPLAY_SHOT,  // one tick that fires, followed by the aim point: snapped if count is 1, raw floats if 0
+    REPLAY_GAME,  // a new game, followed by its seed
+    REPLAY_END    // the game stopped, followed by the hash of its final state
+};
+
+// Writes each tick's input as it is simulated. A record is a varint of
+// count << 6 | move << 2 | tag, so a stretch of ticks with the same keys
+// held costs a byte or two however long it lasts. With the seeds and the
+// settings in the header that is enough to play a session again exactly;
+// the tick delta is the fixed simDt, so it is stored once as the tick rate.
+typedef struct {
+    FILE* file;
+    Uint8 move;  // of the run being counted
+    Uint64 run;  // ticks in it so far
+} ReplayRecorder;
+
+// A replay file loaded whole, read one record at a time as the games ask
+// for input.
+typedef struct {
+    Uint8* data;
+    size_t size;
+    size_t offset;
+    Uint8 move;
+    Uint64 run;           // ticks left in the current run
+    bool playing;         // false once every game has been played
+    bool gameEnded;       // the current game has no input left
+    bool hashKnown;       // its end record was found
+    Uint64 expectedHash;
+    int games;
+    bool diverged;
+} ReplayPlayer;
+
+typedef struct {
+    SDL_Rect src;  // glyph position inside the atlas texture
+    int advance;
+} Glyph;
+
+// Every printable ASCII glyph of one font baked into a single texture.
+typedef struct {
+    SDL_Texture* texture;
+    int width, height;
+    int lineHeight;
+    Glyph glyphs[GLYPH_COUNT];
+} GlyphAtlas;
+
+// A string laid out as textured quads. The quads are only rebuilt when
+// the text, color or position changes, so drawing is one geometry call.
+typedef struct {
+    GlyphAtlas* atlas;
+    char text[MAX_LABEL_LENGTH];
+    SDL_Color color;
+    int x, y;
+    int w, h;
+    int value;
+    bool hasValue;
+    int glyphCount;
+    SDL_Vertex vertices[MAX_LABEL_LENGTH * 4];
+} TextLabel;
+
+enum {
+    PACING_VSYNC,  // SDL_RenderPresent blocks on the display
+    PACING_CAP     // sleep plus spin to a fixed rate, 0 for uncapped
+};
+
+typedef struct {
+    int mode;
+    Uint64 period;    // performance counts per frame in cap mode
+    Uint64 deadline;
+    Uint64 lastFrame;
+    double frameMs;   // duration of the last frame
+    double averageMs; // smoothed frame time
+    double jitterMs;  // smoothed deviation from averageMs
+} FramePacer;
+
+// The world is drawn into an offscreen target at a fraction of the window's
+// resolution and upscaled to it in one copy.
+typedef struct {
+    SDL_Texture* target;
+    bool useTarget;          // false when the renderer can't render to textures
+    int targetWidth, targetHeight;
+    int outputWidth, outputHeight;
+    SDL_Rect letterbox;      // where the world lands in the window, in pixels
+    SDL_Rect view;           // part of the target used at the current scale
+    float scale;
+    float ceiling;           // scale that last ran over budget
+    bool autoScale;
+    double budgetMs;
+    double load;             // smoothed fraction of the frame budget in use
+    Uint32 lastChange;
+} RenderScene;
+
+// SDL's software renderer draws straight into the window surface, so a
+// frame only has to touch what moved. The window is cut into tiles; a tile
+// that anything was drawn on this frame or the last one gets its background
+// copied back from a cached surface before the frame is drawn over it, and
+// only those tiles are presented.
+typedef struct {
+    bool enabled;
+    bool valid;               // the window surface still holds the last frame
+    bool pending;             // a frame is waiting for presentFrame()
+    SDL_Surface* background;  // the game background at the letterbox size, in the window's format
+    Uint8* tiles;             // bit 0 drawn on this frame, bit 1 drawn on the last one
+    int columns, rows;
+    SDL_Rect* rects;
+    int rectCount;
+    int* openRects;           // per column, the rect starting there that the next row may extend
+    int width, height;        // of the window surface
+    SDL_Rect letterbox;
+    Uint64 redrawnPixels;     // since the stats were last shown
+    Uint64 framePixels;
+} DirtyRenderer;
+
+// Input-to-present latency of local play, in milliseconds.
+typedef struct {
+    float samples[LATENCY_SAMPLES];  // ring of the newest
+    float sorted[LATENCY_SAMPLES];
+    Uint64 total;
+    InputStamps presenting;    // shown by late input sampling in the frame being drawn
+    int lateStamped;           // move key events still queued that were already stamped late
+} InputLatency;
+
+enum {
+    ZONE_FRAME,
+    ZONE_EVENTS,
+    ZONE_INPUT,
+    ZONE_SIMULATION,
+    ZONE_COLLISION,
+    ZONE_ENEMIES,
+    ZONE_BULLETS,
+    ZONE_PARTICLES,
+    ZONE_RENDER,
+    ZONE_PRESENT,
+    ZONE_WAIT,
+    ZONE_COUNT
+};
+
+typedef struct {
+    Uint64 start, end;  // performance counter
+    Uint32 frame;
+    Uint32 thread;
+    Uint16 zone;
+} ProfileEvent;
+
+// Zone timings kept in a ring buffer for export, plus per-frame totals of
+// the main and simulation threads' zones for the on-screen overlay.
+typedef struct {
+    bool enabled;
+    bool overlayVisible;
+    ProfileEvent* events;
+    SDL_atomic_t writeIndex;
+    Uint32 frame;
+    SDL_threadID mainThread;
+    SDL_threadID simThread;
+    Uint64 zoneTotal[ZONE_COUNT];
+    float zoneMs[ZONE_COUNT];
+    float frameHistory[PROFILE_HISTORY];
+    int historyIndex;
+    Uint32 labelRefresh;
+    TextLabel labels[ZONE_COUNT + 1];
+} Profiler;
+
+#if COTL_PROFILE
+#define PROFILE_BEGIN(zone) Uint64 profileStart_##zone = profileNow()
+#define PROFILE_END(zone) profileRecord(zone, profileStart_##zone)
+#else
+#define PROFILE_BEGIN(zone) ((void)0)
+#define PROFILE_END(zone) ((void)0)
+#endif
+
+// A button drawn once into a texture and then blitted with a single copy.
+// Moving it is free; only a size change or lost render targets rebuild it.
+typedef struct {
+    SDL_Rect rect;
+    TextLabel label;
+    SDL_Texture* texture;
+    bool dirty;
+} Button;
+
+enum {
+    SPRITE_PLAYER,
+    SPRITE_ENEMY,
+    SPRITE_FIREBALL,
+    SPRITE_WHITE,  // solid texel for colored rectangles
+    SPRITE_COUNT
+};
+
+typedef struct {
+    SDL_Texture* texture;
+    SDL_FRect uv[SPRITE_COUNT];  // normalized texture coordinates
+} SpriteAtlas;
+
+// Quads collected over a frame and submitted with one SDL_RenderGeometry.
+typedef struct {
+    SDL_Vertex* vertices;
+    int* indices;
+    int quadCount;
+    int quadCapacity;
+} SpriteBatch;
+
+enum {
+    PARTICLES_BLEND,     // debris, alpha blended
+    PARTICLES_ADDITIVE,  // sparks and the fireball trail
+    PARTICLE_LAYER_COUNT
+};
+
+// Live particles of one blend mode packed in [0, count) like the bullets.
+// Life runs from 1 down to 0 and scales the alpha; a particle is
+// swap-removed once it reaches 0.
+typedef struct {
+    float* x;
+    float* y;
+    float* vx;
+    float* vy;
+    float* life;
+    float* fade;  // life lost per second
+    SDL_Color* color;
+    int count;
+    int capacity;
+} ParticlePool;
+
+// Cosmetic only: fed from snapshots on the main thread, never by the
+// simulation, so it has no effect on determinism.
+typedef struct {
+    ParticlePool layers[PARTICLE_LAYER_COUNT];
+    Rng rng;
+    int budget;            // particles still allowed this frame
+    float trailX, trailY;  // fireball position the trail last reached
+    float trailCarry;      // fraction of a trail particle owed to the next frame
+    bool trailStarted;
+} ParticleSystem;
+
+enum {
+    SOUND_KILL,
+    SOUND_SHOT,
+    SOUND_HURT,
+    SOUND_GAME_OVER,
+    SOUND_COUNT
+};
+
+// Mono float PCM at AUDIO_FREQUENCY, decoded once at startup.
+typedef struct {
+    float* samples;
+    int frames;
+} Sample;
+
+// Synthesized stand-in for a sound with no file under assets/sounds/.
+typedef struct {
+    float seconds;
+    float startHz, endHz;  // pitch sweep
+    float noise;           // 0 is a pure tone, 1 pure noise
+    float decay;           // amplitude falls by e this many times a second
+} SoundRecipe;
+
+typedef struct {
+    int sound;
+    float volume;
+    float pan;  // -1 left to 1 right
+} AudioCommand;
+
+typedef struct {
+    const Sample* sample;  // NULL when free
+    int position;
+    float left, right;
+    Uint32 started;        // order voices began in, the oldest is stolen first
+} Voice;
+
+// Everything past init is touched by one thread each: the game thread
+// pushes commands at head, and the audio callback pops them at tail and
+// owns the voices. The queue is the only thing they share, so neither
+// side ever locks or allocates.
+typedef struct {
+    SDL_AudioDeviceID device;
+    SDL_AudioSpec spec;
+    Sample samples[SOUND_COUNT];
+    AudioCommand queue[AUDIO_QUEUE_SIZE];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+    Voice voices[AUDIO_VOICES];
+    Uint32 voiceClock;
+    SDL_atomic_t steals;
+    SDL_atomic_t dropped;  // commands that found the queue full
+    int lastHp;            // game thread: detects damage between snapshots
+} AudioMixer;
+
+typedef struct {
+    Sint32 score;
+    Sint64 timestamp;
+} ScoreEntry;
+
+// Leaderboard kept in memory; a background thread persists it whenever
+// the revision moves past the last saved one.
+typedef struct {
+    ScoreEntry entries[LEADERBOARD_SIZE];
+    int count;
+    Uint32 revision;
+    Uint32 savedRevision;
+    bool shuttingDown;
+    SDL_mutex* lock;
+    SDL_cond* changed;
+    SDL_Thread* writer;
+} ScoreStore;
+
+enum {
+    BUNDLE_RAW,
+    BUNDLE_LZ4
+};
+
+typedef struct {
+    char name[BUNDLE_NAME_LENGTH];
+    Uint32 width, height;  // images are RGBA32, zero for other data
+    Uint32 compression;
+    Uint64 offset;
+    Uint64 storedSize;
+    Uint64 rawSize;
+} BundleEntry;
+
+// The packed asset file, memory-mapped read-only. Layout: magic, version,
+// entry count, reserved, then BUNDLE_ENTRY_SIZE bytes per entry (name,
+// width, height, compression, reserved, offset, stored size, raw size) and
+// the entry data, each aligned to BUNDLE_ALIGNMENT. All fields little-endian.
+typedef struct {
+    const Uint8* data;
+    size_t size;
+    int entryCount;
+    BundleEntry entries[BUNDLE_MAX_ENTRIES];
+} AssetBundle;
+
+enum {
+    ASSET_MENU_BACKGROUND,
+    ASSET_BACKGROUND,
+    ASSET_PLAYER,
+    ASSET_ENEMY,
+    ASSET_FIREBALL,
+    ASSET_COUNT
+};
+
+typedef struct {
+    AssetBundle bundle;
+    bool hasBundle;
+    const Uint8* fontData;
+    size_t fontSize;
+    bool ownsFontData;
+    SDL_Thread* loader;
+    SDL_Surface* surfaces[ASSET_COUNT];  // handed from the loader thread to the main thread
+    SDL_atomic_t ready[ASSET_COUNT];
+    bool uploaded[ASSET_COUNT];
+    Uint32 wakeEvent;
+} AssetLoader;
+
+// The backgrounds are the only assets drawn full screen: the menu's at the
+// window size and the game's at the size of the scene it fills.
+#define CACHED_TEXTURE_COUNT (ASSET_BACKGROUND + 1)
+
+typedef struct {
+    SDL_Surface* source;       // decoded at full size, kept for rescaling
+    SDL_Surface* scaledFrom;   // source the current texture was made from
+    SDL_Texture** texture;
+    int width, height;
+} CachedTexture;
 
+// Entries are indexed by asset. At most one worker rescales at a time; it
+// only reads the sources snapshotted when it started.
+typedef struct {
+    CachedTexture entries[CACHED_TEXTURE_COUNT];
+    SDL_Thread* worker;
+    SDL_atomic_t done;
+    SDL_Surface* jobSources[CACHED_TEXTURE_COUNT];
+    SDL_Surface* results[CACHED_TEXTURE_COUNT];
+    SDL_Point jobSizes[CACHED_TEXTURE_COUNT];
+} TextureCache;
 
 SDL_Window* window;
 SDL_Renderer* renderer;
 SDL_Texture* backgroundTexture;
 SDL_Texture* menuBackgroundTexture;
-SDL_Texture* playerTexture;
-SDL_Texture* enemyTexture;
-SDL_Texture* redDotTexture;
+SpriteAtlas spriteAtlas;
+AssetLoader assets;
+TextureCache textureCache = {
+    .entries = { { .texture = &menuBackgroundTexture }, { .texture = &backgroundTexture } }
+};
+const char* assetNames[ASSET_COUNT] = { "mmbg", "bg", "player", "enemy", "fireball" };
+// sprites are packed at the size they are drawn, backgrounds at full size
+const SDL_Point assetPackSizes[ASSET_COUNT] = {
+    { 0, 0 }, { 0, 0 }, { PLAYER_SIZE, PLAYER_SIZE }, { ENEMY_SIZE, ENEMY_SIZE }, { RED_DOT_RADIUS * 2, RED_DOT_RADIUS * 2 }
+};
+Uint64 launchCounter;
+SpriteBatch spriteBatch;
+int drawCallCount;
+int lastFrameDrawCalls;
+FramePacer framePacer;
+RenderScene scene;
+DirtyRenderer dirtyRenderer;
+InputLatency inputLatency;
+Profiler profiler;
+const char* zoneNames[ZONE_COUNT] = {
+    "frame", "events", "input", "simulate", "collide", "enemies", "bullets", "particles", "render", "present", "wait"
+};
 TTF_Font* font;
 TTF_Font* gameOverFont;
+GlyphAtlas fontAtlas;
+GlyphAtlas gameOverAtlas;
+int quadIndices[MAX_LABEL_LENGTH * 6];
+TextLabel scoreLabel;
+TextLabel highScoreLabel;
+TextLabel gameOverLabel;
 
 
 int SCREEN_WIDTH = INITIAL_SCREEN_WIDTH;
@@ -53,425 +975,4956 @@ bool running = false;
 bool menuRunning= true;
 bool isFullScreen = false;
 bool gameOver = false;
-Bullet bullets[MAX_BULLETS];
+BulletPool bullets;
 bool quit = false;
+ScoreStore scoreStore;
+Options options;
+int simTickRate = SIM_TICK_RATE;
+float simDt = 1.0f / SIM_TICK_RATE;
+int damageCooldownTicks = SIM_TICK_RATE / 2;
+SpatialGrid enemyGrid;
+GridCheck gridCheck;
+FlowField flowField;
+SpawnGrid spawnGrid;
+JobSystem jobs;
+FrameArena frameArena;
+AllocCounter allocCounter;
+AllocCheck allocCheck;
+void (*advanceEnemies)(EnemyPool* pool, float step);
+ReplayRecorder recorder;
+ReplayPlayer replay;
+ParticleSystem particles;
+AudioMixer audio;
+const char* soundNames[SOUND_COUNT] = { "kill", "shot", "hurt", "gameover" };
+const SoundRecipe soundRecipes[SOUND_COUNT] = {
+    { 0.12f, 520.0f, 140.0f, 0.6f, 30.0f },   // kill
+    { 0.09f, 1400.0f, 320.0f, 0.1f, 25.0f },  // shot
+    { 0.18f, 110.0f, 60.0f, 0.4f, 18.0f },    // hurt
+    { 0.9f, 440.0f, 110.0f, 0.05f, 3.0f },    // game over
+};
+void (*integrateParticles)(ParticlePool* pool, float dt, float damping);
+
+// splitmix64: tiny, seedable with any value, and identical on every platform
+Uint32 rngNext(Rng* rng) {
+    Uint64 z = (rng->state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return (Uint32)((z ^ (z >> 31)) >> 32);
+}
+
+// Uniform in [0, 1).
+float rngUnit(Rng* rng) {
+    return rngNext(rng) * (1.0f / 4294967296.0f);
+}
+
+void* countingMalloc(size_t size) {
+    SDL_AtomicAdd(&allocCounter.allocations, 1);
+    SDL_AtomicAdd(&allocCounter.bytes, (int)size);
+    return allocCounter.baseMalloc(size);
+}
+
+void* countingCalloc(size_t count, size_t size) {
+    SDL_AtomicAdd(&allocCounter.allocations, 1);
+    SDL_AtomicAdd(&allocCounter.bytes, (int)(count * size));
+    return allocCounter.baseCalloc(count, size);
+}
+
+void* countingRealloc(void* memory, size_t size) {
+    SDL_AtomicAdd(&allocCounter.allocations, 1);
+    SDL_AtomicAdd(&allocCounter.bytes, (int)size);
+    return allocCounter.baseRealloc(memory, size);
+}
+
+void countingFree(void* memory) {
+    if (memory) {
+        SDL_AtomicAdd(&allocCounter.frees, 1);
+    }
+    allocCounter.baseFree(memory);
+}
+
+// Has to run before SDL allocates anything, so memory is never freed by
+// another allocator than the one that returned it.
+void installAllocCounter() {
+    SDL_GetMemoryFunctions(&allocCounter.baseMalloc, &allocCounter.baseCalloc,
+        &allocCounter.baseRealloc, &allocCounter.baseFree);
+    SDL_SetMemoryFunctions(countingMalloc, countingCalloc, countingRealloc, countingFree);
+}
+
+int allocationCount() {
+    return SDL_AtomicGet(&allocCounter.allocations);
+}
+
+void initFrameArena() {
+    frameArena.base = SDL_malloc(FRAME_ARENA_SIZE);
+    frameArena.size = frameArena.base ? FRAME_ARENA_SIZE : 0;
+}
+
+void* frameAlloc(size_t size) {
+    size_t offset = (frameArena.used + FRAME_ARENA_ALIGNMENT - 1) & ~(size_t)(FRAME_ARENA_ALIGNMENT - 1);
+    if (offset + size <= frameArena.size) {
+        frameArena.used = offset + size;
+        if (frameArena.used > frameArena.peak) frameArena.peak = frameArena.used;
+        return frameArena.base + offset;
+    }
+    // the header keeps the block aligned like arena memory
+    Uint8* block = SDL_malloc(FRAME_ARENA_ALIGNMENT + size);
+    if (!block) {
+        return NULL;
+    }
+    *(void**)block = frameArena.overflow;
+    frameArena.overflow = block;
+    return block + FRAME_ARENA_ALIGNMENT;
+}
+
+void frameArenaReset() {
+    while (frameArena.overflow) {
+        void* next = *(void**)frameArena.overflow;
+        SDL_free(frameArena.overflow);
+        frameArena.overflow = next;
+    }
+    frameArena.used = 0;
+}
+
+void freeFrameArena() {
+    frameArenaReset();
+    SDL_free(frameArena.base);
+    frameArena = (FrameArena){ 0 };
+}
+
+// Exempts the next frames, for work that allocates on purpose: starting a
+// game, or rebuilding textures after the window or render scale changed.
+void allocCheckWarmup() {
+    allocCheck.warmup = ALLOC_CHECK_WARMUP_FRAMES;
+}
+
+// For a frame that allocates inside SDL on purpose, e.g. to set the title.
+void allocCheckSkipFrame() {
+    allocCheck.skipFrame = true;
+}
+
+// Called at the end of every frame; all allocations since the previous call,
+// on any thread, count against this frame.
+void allocCheckFrame() {
+    int count = allocationCount();
+    int allocated = count - allocCheck.lastCount;
+    allocCheck.lastCount = count;
+    bool skip = allocCheck.skipFrame;
+    allocCheck.skipFrame = false;
+    if (!options.allocCheck || skip) {
+        return;
+    }
+    if (allocCheck.warmup > 0) {
+        allocCheck.warmup--;
+        return;
+    }
+    allocCheck.frames++;
+    if (allocated > 0 && allocCheck.failures++ < ALLOC_CHECK_MAX_REPORTS) {
+        SDL_Log("Steady-state frame %llu made %d heap allocations",
+            (unsigned long long)allocCheck.frames, allocated);
+    }
+}
+
+// Returns the exit status for --alloc-check.
+int allocCheckReport() {
+    if (!options.allocCheck) {
+        return 0;
+    }
+    printf("alloc_check frames=%llu allocating_frames=%llu arena_peak_bytes=%llu %s\n",
+        (unsigned long long)allocCheck.frames, (unsigned long long)allocCheck.failures,
+        (unsigned long long)frameArena.peak, allocCheck.failures == 0 ? "PASS" : "FAIL");
+    return allocCheck.failures == 0 ? 0 : 1;
+}
+
+bool takeJob(JobQueue* queue, Job* job, bool back) {
+    bool found = false;
+    SDL_AtomicLock(&queue->lock);
+    if (queue->head != queue->tail) {
+        *job = back ? queue->jobs[--queue->tail & (JOB_QUEUE_SIZE - 1)] :
+            queue->jobs[queue->head++ & (JOB_QUEUE_SIZE - 1)];
+        found = true;
+    }
+    SDL_AtomicUnlock(&queue->lock);
+    return found;
+}
+
+// Runs one job from this worker's own queue or, failing that, one stolen
+// from another worker. Returns false when every queue is empty.
+bool runOneJob(int worker) {
+    Job job;
+    bool found = worker < jobs.workerCount && takeJob(&jobs.queues[worker], &job, true);
+    for (int i = 1; i <= jobs.workerCount && !found; i++) {
+        found = takeJob(&jobs.queues[(worker + i) % jobs.workerCount], &job, false);
+    }
+    if (!found) {
+        return false;
+    }
+    job.function(job.data, job.begin, job.end, worker);
+    if (SDL_AtomicAdd(&jobs.pending, -1) == 1) {
+        SDL_SemPost(jobs.done);
+    }
+    return true;
+}
+
+int jobWorker(void* data) {
+    int worker = (int)(intptr_t)data;
+    while (true) {
+        SDL_SemWait(jobs.wake);
+        if (SDL_AtomicGet(&jobs.quit)) {
+            break;
+        }
+        while (runOneJob(worker)) {}
+    }
+    return 0;
+}
+
+// threads counts the calling thread too, 0 picks one per core.
+void initJobSystem(int threads) {
+    if (threads <= 0) {
+        threads = SDL_GetCPUCount();
+    }
+    int workers = threads - 1;
+    if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+    if (workers > 0) {
+        jobs.wake = SDL_CreateSemaphore(0);
+        jobs.done = SDL_CreateSemaphore(0);
+    }
+    for (int i = 0; i < workers && jobs.wake && jobs.done; i++) {
+        char name[16];
+        SDL_snprintf(name, sizeof(name), "worker %d", i);
+        jobs.threads[i] = SDL_CreateThread(jobWorker, name, (void*)(intptr_t)i);
+        if (!jobs.threads[i]) {
+            break;
+        }
+        jobs.workerCount++;
+    }
+}
 
-int loadHighScore();
+void shutdownJobSystem() {
+    SDL_AtomicSet(&jobs.quit, 1);
+    for (int i = 0; i < jobs.workerCount; i++) {
+        SDL_SemPost(jobs.wake);
+    }
+    for (int i = 0; i < jobs.workerCount; i++) {
+        SDL_WaitThread(jobs.threads[i], NULL);
+    }
+    if (jobs.wake) SDL_DestroySemaphore(jobs.wake);
+    if (jobs.done) SDL_DestroySemaphore(jobs.done);
+    for (int i = 0; i <= MAX_WORKERS; i++) {
+        SDL_free(jobs.scratch[i]);
+    }
+    jobs = (JobSystem){ 0 };
+}
+
+void reserveJobScratch(int capacity) {
+    if (capacity <= jobs.scratchCapacity) {
+        return;
+    }
+    for (int i = 0; i <= jobs.workerCount; i++) {
+        jobs.scratch[i] = SDL_realloc(jobs.scratch[i], capacity * sizeof(int));
+    }
+    jobs.scratchCapacity = capacity;
+}
+
+// Calls function over [0, count) in chunks of at least grain items, spread
+// over the workers while the calling thread helps, and returns once every
+// chunk is done. Small batches run inline.
+void parallelFor(JobFunction function, void* data, int count, int grain) {
+    int workers = jobs.workerCount;
+    if (workers == 0 || count <= grain) {
+        if (count > 0) {
+            function(data, 0, count, workers);
+        }
+        return;
+    }
+    int limit = workers * JOB_QUEUE_SIZE;
+    int jobCount = (count + grain - 1) / grain;
+    if (jobCount > limit) {
+        grain *= (jobCount + limit - 1) / limit;
+        jobCount = (count + grain - 1) / grain;
+    }
+
+    SDL_AtomicSet(&jobs.pending, jobCount);
+    for (int i = 0; i < jobCount; i++) {
+        JobQueue* queue = &jobs.queues[i % workers];
+        int end = (i + 1) * grain < count ? (i + 1) * grain : count;
+        SDL_AtomicLock(&queue->lock);
+        queue->jobs[queue->tail++ & (JOB_QUEUE_SIZE - 1)] = (Job){ function, data, i * grain, end };
+        SDL_AtomicUnlock(&queue->lock);
+    }
+    for (int i = 0; i < workers && i < jobCount; i++) {
+        SDL_SemPost(jobs.wake);
+    }
+    // help until the queues are empty, then wait for jobs still running elsewhere
+    while (runOneJob(workers)) {}
+    SDL_SemWait(jobs.done);
+}
+
+void reserveEnemies(EnemyPool* pool, int capacity) {
+    if (capacity <= pool->capacity) {
+        return;
+    }
+    pool->x = SDL_realloc(pool->x, capacity * sizeof(float));
+    pool->y = SDL_realloc(pool->y, capacity * sizeof(float));
+    pool->steerX = SDL_realloc(pool->steerX, capacity * sizeof(float));
+    pool->steerY = SDL_realloc(pool->steerY, capacity * sizeof(float));
+    pool->alive = SDL_realloc(pool->alive, capacity * sizeof(bool));
+    pool->capacity = capacity;
+}
+
+void freeEnemies(EnemyPool* pool) {
+    SDL_free(pool->x);
+    SDL_free(pool->y);
+    SDL_free(pool->steerX);
+    SDL_free(pool->steerY);
+    SDL_free(pool->alive);
+    *pool = (EnemyPool){ 0 };
+}
 
-void spawnEnemy(Entity* enemy) {
-    enemy->x = rand() % (SCREEN_WIDTH - ENEMY_SIZE);
-    enemy->y = rand() % (SCREEN_HEIGHT - ENEMY_SIZE);
-    enemy->size = ENEMY_SIZE;
-    enemy->alive = true;
+// Dead enemies are swap-removed every tick, so count is the live count.
+bool allEnemiesDefeated(const EnemyPool* enemies) {
+    return enemies->count == 0;
+}
+
+void spawnEnemy(EnemyPool* pool, float x, float y) {
+    if (pool->count == pool->capacity) {
+        return;
+    }
+    int i = pool->count++;
+    pool->x[i] = x;
+    pool->y[i] = y;
+    pool->alive[i] = true;
+}
+
+void removeDeadEnemies(EnemyPool* pool, KillEvents* kills) {
+    int i = 0;
+    while (i < pool->count) {
+        if (pool->alive[i]) {
+            i++;
+            continue;
+        }
+        if (kills->count < MAX_KILL_EVENTS) {
+            kills->x[kills->count] = pool->x[i] + ENEMY_SIZE / 2;
+            kills->y[kills->count] = pool->y[i] + ENEMY_SIZE / 2;
+            kills->count++;
+        }
+        int last = --pool->count;
+        pool->x[i] = pool->x[last];
+        pool->y[i] = pool->y[last];
+        pool->alive[i] = pool->alive[last];
+    }
 }
 
 bool checkCollision(float x1, float y1, int size1, 
 float x2, float y2, int size2) {
     float dx = x1 - x2;
     float dy = y1 - y2;
-    float distance = sqrt(dx * dx + dy * dy);
-    return distance < (size1 / 2 + size2 / 2);
+    float reach = (float)(size1 / 2 + size2 / 2);
+    return dx * dx + dy * dy < reach * reach;
 }
 
-void scalePositionsAndSizes(float scaleX, float scaleY, 
-Entity* player, Entity enemies[], int enemyCount) {
-    // playerPos
-    player->x *= scaleX;
-    player->y *= scaleY;
+// Time in [0, 1] at which a point moving from (px, py) by (dx, dy) first
+// comes closer than reach to (cx, cy), or -1 if it never does this step.
+float sweepPointCircle(float px, float py, float dx, float dy, float cx, float cy, float reach) {
+    float ox = px - cx;
+    float oy = py - cy;
+    float c = ox * ox + oy * oy - reach * reach;
+    if (c < 0) {
+        return 0;  // already overlapping
+    }
+    float a = dx * dx + dy * dy;
+    float b = dx * ox + dy * oy;
+    if (a == 0 || b >= 0) {
+        return -1;  // not moving, or moving away
+    }
+    float discriminant = b * b - a * c;
+    if (discriminant < 0) {
+        return -1;
+    }
+    float t = (-b - sqrtf(discriminant)) / a;
+    return t <= 1 ? t : -1;
+}
 
-    // enemyPos
-    for (int i = 0; i < enemyCount; i++) {
-        if (enemies[i].alive) {
-            enemies[i].x *= scaleX;
-            enemies[i].y *= scaleY;
-        }
+// Whether a point orbiting (px, py) at orbitRadius, sweeping from angle
+// start through sweep radians, comes closer than reach to (cx, cy).
+bool sweepArcCircle(float px, float py, float orbitRadius, float start, float sweep,
+float cx, float cy, float reach) {
+    float ox = cx - px;
+    float oy = cy - py;
+    float d = sqrtf(ox * ox + oy * oy);
+    if (d == 0) {
+        return orbitRadius < reach;
+    }
+    // law of cosines: within reach where cos(theta - phi) > k
+    float k = (orbitRadius * orbitRadius + d * d - reach * reach) / (2 * orbitRadius * d);
+    if (k >= 1) {
+        return false;
+    }
+    if (k <= -1 || sweep >= 2 * PI) {
+        return true;
     }
+    float halfWidth = acosf(k);
+    float offset = fmodf(atan2f(oy, ox) - start, 2 * PI);
+    if (offset < 0) offset += 2 * PI;
+    return offset < sweep + halfWidth || offset > 2 * PI - halfWidth;
 }
 
-void shootBullets(float x, float y, float targetX, float targetY, int numBullets) {
-    float baseAngle = atan2(targetY - y, targetX - x);
-    float spread = 0.3f;
+int compareInts(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
 
-    if(score >= 30){
-        for (int i = 0; i < numBullets; i++) {
-            for (int j = 0; j < MAX_BULLETS; j++) {
-                if (!bullets[j].active) {
-                    float angleOffset = (i - (numBullets - 1) / 2.0f) * spread;
-                    bullets[j].x = x;
-                    bullets[j].y = y;
-                    bullets[j].angle = baseAngle + angleOffset;
-                    bullets[j].active = true;
-                    break;
-                }
-            }
-        }
+int compareFloats(const void* a, const void* b) {
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+int gridCellCoord(float v, float cellSize, int cells) {
+    int c = (int)floorf(v / cellSize);
+    if (c < 0) return 0;
+    if (c >= cells) return cells - 1;
+    return c;
+}
+
+// Rebuilds the grid from the enemy centers with a counting sort. Entities
+// outside the screen are clamped into the border cells, which the queries
+// clamp the same way, so nothing is ever missed.
+void reserveGrid(SpatialGrid* grid, int count) {
+    int cellCount = (WORLD_WIDTH / GRID_CELL_SIZE + 1) * (WORLD_HEIGHT / GRID_CELL_SIZE + 1);
+    if (cellCount + 1 > grid->cellCapacity) {
+        grid->cellStart = SDL_realloc(grid->cellStart, (cellCount + 1) * sizeof(int));
+        grid->cellFill = SDL_realloc(grid->cellFill, cellCount * sizeof(int));
+        grid->cellCapacity = cellCount + 1;
+    }
+    if (count > grid->itemCapacity) {
+        grid->items = SDL_realloc(grid->items, count * sizeof(int));
+        grid->itemX = SDL_realloc(grid->itemX, count * sizeof(float));
+        grid->itemY = SDL_realloc(grid->itemY, count * sizeof(float));
+        grid->itemCell = SDL_realloc(grid->itemCell, count * sizeof(int));
+        grid->results = SDL_realloc(grid->results, count * sizeof(int));
+        grid->itemCapacity = count;
     }
 }
 
-void updateBullets(float deltaTime) {
-    for (int i = 0; i < MAX_BULLETS; i++) {
-        if (bullets[i].active) {
-            float speed = 300.0f; 
-            bullets[i].x += cos(bullets[i].angle) * speed * deltaTime;
-            bullets[i].y += sin(bullets[i].angle) * speed * deltaTime;
+void gridBuild(SpatialGrid* grid, const EnemyPool* enemies) {
+    int count = enemies->count;
+    int cols = WORLD_WIDTH / GRID_CELL_SIZE + 1;
+    int rows = WORLD_HEIGHT / GRID_CELL_SIZE + 1;
+    int cellCount = cols * rows;
 
-            if (bullets[i].x < 0 || bullets[i].x > SCREEN_WIDTH ||
-                bullets[i].y < 0 || bullets[i].y > SCREEN_HEIGHT) {
-                bullets[i].active = false;
-            }
+    reserveGrid(grid, count);
+    grid->cols = cols;
+    grid->rows = rows;
+    grid->margin = ENEMY_SIZE / 2;
+    memset(grid->cellStart, 0, (cellCount + 1) * sizeof(int));
+
+    for (int i = 0; i < count; i++) {
+        if (!enemies->alive[i]) {
+            grid->itemCell[i] = -1;
+            continue;
+        }
+        int cx = gridCellCoord(enemies->x[i] + ENEMY_SIZE / 2, GRID_CELL_SIZE, cols);
+        int cy = gridCellCoord(enemies->y[i] + ENEMY_SIZE / 2, GRID_CELL_SIZE, rows);
+        grid->itemCell[i] = cy * cols + cx;
+        grid->cellStart[grid->itemCell[i] + 1]++;
+    }
+    for (int c = 0; c < cellCount; c++) {
+        grid->cellStart[c + 1] += grid->cellStart[c];
+        grid->cellFill[c] = grid->cellStart[c];
+    }
+    for (int i = 0; i < count; i++) {
+        if (grid->itemCell[i] >= 0) {
+            int k = grid->cellFill[grid->itemCell[i]]++;
+            grid->items[k] = i;
+            grid->itemX[k] = enemies->x[i] + ENEMY_SIZE / 2;
+            grid->itemY[k] = enemies->y[i] + ENEMY_SIZE / 2;
         }
     }
 }
 
-void renderBullets() {
-    SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255); // Yellow
-    for (int i = 0; i < MAX_BULLETS; i++) {
-        if (bullets[i].active) {
-            SDL_Rect bulletRect = { (int)bullets[i].x - 5, (int)bullets[i].y - 5, 10, 10 };
-            SDL_RenderFillRect(renderer, &bulletRect);
+// Writes the index of every entity that may overlap the box into out,
+// in ascending order so callers visit them the same way a full scan would.
+int gridQuery(const SpatialGrid* grid, float minX, float minY, float maxX, float maxY, int* out) {
+    int x0 = gridCellCoord(minX - grid->margin, GRID_CELL_SIZE, grid->cols);
+    int y0 = gridCellCoord(minY - grid->margin, GRID_CELL_SIZE, grid->rows);
+    int x1 = gridCellCoord(maxX + grid->margin, GRID_CELL_SIZE, grid->cols);
+    int y1 = gridCellCoord(maxY + grid->margin, GRID_CELL_SIZE, grid->rows);
+    int found = 0;
+
+    for (int cy = y0; cy <= y1; cy++) {
+        for (int cx = x0; cx <= x1; cx++) {
+            int cell = cy * grid->cols + cx;
+            for (int k = grid->cellStart[cell]; k < grid->cellStart[cell + 1]; k++) {
+                out[found++] = grid->items[k];
+            }
         }
     }
-}
 
-void checkBulletCollisions(Entity enemies[]) {
-    for (int i = 0; i < MAX_BULLETS; i++) {
-        if (bullets[i].active) {
-            for (int j = 0; j < ENEMY_COUNT; j++) {
-                if (enemies[j].alive && checkCollision(
-                        bullets[i].x, bullets[i].y, 10, // Bullet size
-                        enemies[j].x + enemies[j].size / 2, 
-                        enemies[j].y + enemies[j].size / 2, 
-                        enemies[j].size)) {
-                    bullets[i].active = false;
-                    enemies[j].alive = false;
-                    score++;
-                    ENEMY_SPEED += 1.5;
-                    break;
-                }
+    if (found <= 16) {
+        for (int i = 1; i < found; i++) {
+            int v = out[i], j = i - 1;
+            while (j >= 0 && out[j] > v) {
+                out[j + 1] = out[j];
+                j--;
             }
+            out[j + 1] = v;
         }
+    } else {
+        qsort(out, found, sizeof(int), compareInts);
     }
+    return found;
 }
 
-int calculateNumBullets() {
-    if (score < 60) return 1;
+void heapPush(Sint64* heap, int* count, Sint64 key) {
+    int i = (*count)++;
+    while (i > 0 && heap[(i - 1) / 2] > key) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = key;
+}
+
+Sint64 heapPop(Sint64* heap, int* count) {
+    Sint64 top = heap[0];
+    Sint64 key = heap[--*count];
+    int i = 0;
+    while (2 * i + 1 < *count) {
+        int child = 2 * i + 1;
+        if (child + 1 < *count && heap[child + 1] < heap[child]) child++;
+        if (heap[child] >= key) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = key;
+    return top;
+}
+
+void initFlowField(FlowField* field) {
+    if (field->distance) {
+        return;
+    }
+    field->cols = WORLD_WIDTH / FLOW_CELL_SIZE;
+    field->rows = WORLD_HEIGHT / FLOW_CELL_SIZE;
+    int cellCount = field->cols * field->rows;
+    field->blocked = SDL_calloc(cellCount, sizeof(Uint8));
+    field->distance = SDL_malloc(cellCount * sizeof(int));
+    field->dirX = SDL_malloc(cellCount * sizeof(float));
+    field->dirY = SDL_malloc(cellCount * sizeof(float));
+    field->heap = SDL_malloc(cellCount * 8 * sizeof(Sint64));  // each cell is pushed at most once per neighbour
+    field->goalCell = -1;
+}
+
+int flowCell(const FlowField* field, float x, float y) {
+    return gridCellCoord(y, FLOW_CELL_SIZE, field->rows) * field->cols + gridCellCoord(x, FLOW_CELL_SIZE, field->cols);
+}
+
+// Diagonal steps may not cut the corner of a blocked cell.
+bool flowStepOpen(const FlowField* field, int cx, int cy, int dx, int dy) {
+    int x = cx + dx, y = cy + dy;
+    if (x < 0 || y < 0 || x >= field->cols || y >= field->rows || field->blocked[y * field->cols + x]) {
+        return false;
+    }
+    return dx == 0 || dy == 0 ||
+        (!field->blocked[cy * field->cols + x] && !field->blocked[y * field->cols + cx]);
+}
+
+// Recomputes the distance from every cell to the goal, then points each cell
+// at its closest neighbour. Unreachable cells get no heading.
+void buildFlowField(FlowField* field, float goalX, float goalY) {
+    static const int stepX[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+    static const int stepY[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+    int goal = flowCell(field, goalX, goalY);
+    if (goal == field->goalCell) {
+        return;
+    }
+    field->goalCell = goal;
+    int cellCount = field->cols * field->rows;
+    for (int c = 0; c < cellCount; c++) {
+        field->distance[c] = SDL_MAX_SINT32;
+    }
+
+    int heapCount = 0;
+    field->distance[goal] = 0;
+    heapPush(field->heap, &heapCount, goal);
+    while (heapCount > 0) {
+        Sint64 key = heapPop(field->heap, &heapCount);
+        int cell = (int)(key & 0xFFFFFFFF);
+        int distance = (int)(key >> 32);
+        if (distance > field->distance[cell]) {
+            continue;  // stale entry, the cell was reached more cheaply since
+        }
+        int cx = cell % field->cols, cy = cell / field->cols;
+        for (int k = 0; k < 8; k++) {
+            if (!flowStepOpen(field, cx, cy, stepX[k], stepY[k])) continue;
+            int next = cell + stepY[k] * field->cols + stepX[k];
+            int cost = distance + (k < 4 ? FLOW_STRAIGHT_COST : FLOW_DIAGONAL_COST);
+            if (cost < field->distance[next]) {
+                field->distance[next] = cost;
+                heapPush(field->heap, &heapCount, (Sint64)cost << 32 | next);
+            }
+        }
+    }
+
+    for (int cell = 0; cell < cellCount; cell++) {
+        int cx = cell % field->cols, cy = cell / field->cols;
+        int best = field->distance[cell];
+        field->dirX[cell] = 0;
+        field->dirY[cell] = 0;
+        for (int k = 0; k < 8; k++) {
+            if (!flowStepOpen(field, cx, cy, stepX[k], stepY[k])) continue;
+            int next = cell + stepY[k] * field->cols + stepX[k];
+            if (field->distance[next] < best) {
+                best = field->distance[next];
+                float length = k < 4 ? 1.0f : (float)(1.0 / 1.4142135623730951);
+                field->dirX[cell] = stepX[k] * length;
+                field->dirY[cell] = stepY[k] * length;
+            }
+        }
+    }
+}
+
+// Heading at a point, blended between the four nearest cell centers so
+// enemies turn smoothly instead of in 45 degree steps.
+void sampleFlowField(const FlowField* field, float x, float y, float* dirX, float* dirY) {
+    float fx = x / FLOW_CELL_SIZE - 0.5f;
+    float fy = y / FLOW_CELL_SIZE - 0.5f;
+    int x0 = gridCellCoord(fx, 1, field->cols), y0 = gridCellCoord(fy, 1, field->rows);
+    int x1 = x0 + 1 < field->cols ? x0 + 1 : x0;
+    int y1 = y0 + 1 < field->rows ? y0 + 1 : y0;
+    float tx = fx - x0, ty = fy - y0;
+    if (tx < 0) tx = 0;
+    if (tx > 1) tx = 1;
+    if (ty < 0) ty = 0;
+    if (ty > 1) ty = 1;
+
+    int c00 = y0 * field->cols + x0, c10 = y0 * field->cols + x1;
+    int c01 = y1 * field->cols + x0, c11 = y1 * field->cols + x1;
+    float topX = field->dirX[c00] + (field->dirX[c10] - field->dirX[c00]) * tx;
+    float topY = field->dirY[c00] + (field->dirY[c10] - field->dirY[c00]) * tx;
+    float bottomX = field->dirX[c01] + (field->dirX[c11] - field->dirX[c01]) * tx;
+    float bottomY = field->dirY[c01] + (field->dirY[c11] - field->dirY[c01]) * tx;
+    *dirX = topX + (bottomX - topX) * ty;
+    *dirY = topY + (bottomY - topY) * ty;
+}
+
+WaveDefinition waveDefinition(int wave) {
+    if (options.waveCount == 0) {
+        return (WaveDefinition){ options.waveSize, WAVE_SPAWN_TICKS };
+    }
+    return options.waves[wave < options.waveCount ? wave : options.waveCount - 1];
+}
+
+// Waves never overlap, so pools sized for the largest one never grow during a game.
+int largestWave() {
+    int largest = options.waveCount == 0 ? options.waveSize : 0;
+    for (int i = 0; i < options.waveCount; i++) {
+        if (options.waves[i].count > largest) largest = options.waves[i].count;
+    }
+    return largest;
+}
+
+float waveSpacing(int count) {
+    float spacing = 0.5f * sqrtf((float)WORLD_WIDTH * WORLD_HEIGHT / count);
+    return spacing > ENEMY_SIZE ? ENEMY_SIZE : spacing < SPAWN_MIN_SPACING ? 0 : spacing;
+}
+
+void resetSpawnGrid(SpawnGrid* grid, float spacing) {
+    grid->cellSize = spacing / 1.41421356f;
+    grid->cols = (int)ceilf(WORLD_WIDTH / grid->cellSize);
+    grid->rows = (int)ceilf(WORLD_HEIGHT / grid->cellSize);
+    int cellCount = grid->cols * grid->rows;
+    if (cellCount > grid->capacity) {
+        grid->pointX = SDL_realloc(grid->pointX, cellCount * sizeof(float));
+        grid->pointY = SDL_realloc(grid->pointY, cellCount * sizeof(float));
+        grid->used = SDL_realloc(grid->used, cellCount);
+        grid->capacity = cellCount;
+    }
+    memset(grid->used, 0, cellCount);
+}
+
+bool spawnPointFree(const SpawnGrid* grid, float x, float y, float spacing) {
+    int cx = gridCellCoord(x, grid->cellSize, grid->cols);
+    int cy = gridCellCoord(y, grid->cellSize, grid->rows);
+    for (int gy = cy - 2; gy <= cy + 2; gy++) {
+        for (int gx = cx - 2; gx <= cx + 2; gx++) {
+            if (gx < 0 || gy < 0 || gx >= grid->cols || gy >= grid->rows) continue;
+            int cell = gy * grid->cols + gx;
+            if (!grid->used[cell]) continue;
+            float dx = grid->pointX[cell] - x, dy = grid->pointY[cell] - y;
+            if (dx * dx + dy * dy < spacing * spacing) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Queues the next wave. Spacing aims at half the mean distance between
+// enemies so dart throwing rarely fails, and is dropped altogether for
+// waves too dense for it to matter.
+void startWave(World* world, int wave) {
+    WaveDefinition definition = waveDefinition(wave);
+    WaveDirector* director = &world->waves;
+    director->wave = wave;
+    director->queued = definition.count;
+    director->perTick = (definition.count + definition.spawnTicks - 1) / definition.spawnTicks;
+    if (director->perTick > SPAWN_MAX_PER_TICK) director->perTick = SPAWN_MAX_PER_TICK;
+    director->spacing = waveSpacing(definition.count);
+    if (director->spacing > 0) {
+        resetSpawnGrid(&spawnGrid, director->spacing);
+    }
+    reserveEnemies(&world->enemies, definition.count);
+}
+
+// Dart throwing against the wave's earlier spawns: up to SPAWN_ATTEMPTS
+// random candidates, keeping the first that is far enough from the player,
+// from other spawns and out of blocked cells. If none is, the world is
+// full, and the rest of the wave only keeps away from the player.
+void placeEnemy(World* world) {
+    WaveDirector* director = &world->waves;
+    float playerX = world->player.x + PLAYER_SIZE / 2, playerY = world->player.y + PLAYER_SIZE / 2;
+    float fallbackX = 0, fallbackY = 0;
+    bool haveFallback = false;
+    for (int attempt = 0; attempt < SPAWN_ATTEMPTS; attempt++) {
+        float x = ENEMY_SIZE / 2 + rngNext(&world->rng) * (1.0f / 4294967296.0f) * (WORLD_WIDTH - ENEMY_SIZE);
+        float y = ENEMY_SIZE / 2 + rngNext(&world->rng) * (1.0f / 4294967296.0f) * (WORLD_HEIGHT - ENEMY_SIZE);
+        float dx = x - playerX, dy = y - playerY;
+        if (dx * dx + dy * dy < SPAWN_SAFE_RADIUS * SPAWN_SAFE_RADIUS || flowField.blocked[flowCell(&flowField, x, y)]) {
+            continue;
+        }
+        if (director->spacing > 0) {
+            if (!spawnPointFree(&spawnGrid, x, y, director->spacing)) {
+                if (!haveFallback) {
+                    fallbackX = x;
+                    fallbackY = y;
+                    haveFallback = true;
+                }
+                continue;
+            }
+            int cell = gridCellCoord(y, spawnGrid.cellSize, spawnGrid.rows) * spawnGrid.cols +
+                gridCellCoord(x, spawnGrid.cellSize, spawnGrid.cols);
+            spawnGrid.pointX[cell] = x;
+            spawnGrid.pointY[cell] = y;
+            spawnGrid.used[cell] = 1;
+        }
+        spawnEnemy(&world->enemies, x - ENEMY_SIZE / 2, y - ENEMY_SIZE / 2);
+        return;
+    }
+    if (haveFallback) {
+        director->spacing = 0;
+        spawnEnemy(&world->enemies, fallbackX - ENEMY_SIZE / 2, fallbackY - ENEMY_SIZE / 2);
+    }
+}
+
+// Starts the next wave once the last one is both fully spawned and cleared,
+// then lets in this tick's share of the queue.
+void updateWaves(World* world) {
+    WaveDirector* director = &world->waves;
+    if (director->queued == 0 && allEnemiesDefeated(&world->enemies)) {
+        startWave(world, director->wave + 1);
+    }
+    for (int i = 0; i < director->perTick && director->queued > 0; i++) {
+        placeEnemy(world);
+        director->queued--;
+    }
+}
+
+void reserveBullets(BulletPool* pool, int capacity) {
+    if (capacity <= pool->capacity) {
+        return;
+    }
+    pool->x = SDL_realloc(pool->x, capacity * sizeof(float));
+    pool->y = SDL_realloc(pool->y, capacity * sizeof(float));
+    pool->vx = SDL_realloc(pool->vx, capacity * sizeof(float));
+    pool->vy = SDL_realloc(pool->vy, capacity * sizeof(float));
+    pool->hit = SDL_realloc(pool->hit, capacity * sizeof(int));
+    pool->capacity = capacity;
+}
+
+void freeBullets(BulletPool* pool) {
+    SDL_free(pool->x);
+    SDL_free(pool->y);
+    SDL_free(pool->vx);
+    SDL_free(pool->vy);
+    SDL_free(pool->hit);
+    *pool = (BulletPool){ 0 };
+}
+
+void removeBullet(BulletPool* pool, int i) {
+    int last = --pool->count;
+    pool->x[i] = pool->x[last];
+    pool->y[i] = pool->y[last];
+    pool->vx[i] = pool->vx[last];
+    pool->vy[i] = pool->vy[last];
+    pool->hit[i] = pool->hit[last];
+}
+
+void shootBullets(float x, float y, float targetX, float targetY, int numBullets) {
+    float baseAngle = atan2f(targetY - y, targetX - x);
+    float spread = 0.3f;
+
+    if(score >= 30){
+        for (int i = 0; i < numBullets && bullets.count < options.bulletLimit; i++) {
+            float angle = baseAngle + (i - (numBullets - 1) / 2.0f) * spread;
+            int j = bullets.count++;
+            bullets.x[j] = x;
+            bullets.y[j] = y;
+            bullets.vx[j] = cosf(angle) * BULLET_SPEED;
+            bullets.vy[j] = sinf(angle) * BULLET_SPEED;
+        }
+    }
+}
+
+void updateBullets(float deltaTime) {
+    // kept branch-free so the compiler can vectorize it
+    for (int i = 0; i < bullets.count; i++) {
+        bullets.x[i] += bullets.vx[i] * deltaTime;
+        bullets.y[i] += bullets.vy[i] * deltaTime;
+    }
+
+    int i = 0;
+    while (i < bullets.count) {
+        if (bullets.x[i] < 0 || bullets.x[i] > WORLD_WIDTH ||
+            bullets.y[i] < 0 || bullets.y[i] > WORLD_HEIGHT) {
+            removeBullet(&bullets, i);
+        } else {
+            i++;
+        }
+    }
+}
+
+void initPacer(FramePacer* pacer, int mode, int fps) {
+    pacer->mode = mode;
+    pacer->period = fps > 0 ? SDL_GetPerformanceFrequency() / fps : 0;
+    pacer->lastFrame = SDL_GetPerformanceCounter();
+    pacer->deadline = pacer->lastFrame + pacer->period;
+    pacer->frameMs = 0;
+    pacer->averageMs = 0;
+    pacer->jitterMs = 0;
+}
+
+// Call once per presented frame. In cap mode it sleeps until shortly before
+// the deadline and spins for the rest, since SDL_Delay can overshoot by a
+// millisecond or more. It also updates the frame time and jitter figures.
+void pacerEndFrame(FramePacer* pacer) {
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+
+    if (pacer->mode == PACING_CAP && pacer->period > 0) {
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (now < pacer->deadline) {
+            Uint64 remainingMs = (pacer->deadline - now) * 1000 / frequency;
+            if (remainingMs > PACER_SPIN_MS) {
+                SDL_Delay((Uint32)(remainingMs - PACER_SPIN_MS));
+            }
+            while (SDL_GetPerformanceCounter() < pacer->deadline) {
+                // spin for the last stretch
+            }
+            pacer->deadline += pacer->period;
+        } else {
+            // fell behind, don't try to catch up with a burst of frames
+            pacer->deadline = now + pacer->period;
+        }
+    }
+
+    Uint64 now = SDL_GetPerformanceCounter();
+    pacer->frameMs = (double)(now - pacer->lastFrame) * 1000.0 / frequency;
+    pacer->lastFrame = now;
+    if (pacer->averageMs == 0) {
+        pacer->averageMs = pacer->frameMs;
+    }
+    double deviation = fabs(pacer->frameMs - pacer->averageMs);
+    pacer->averageMs += (pacer->frameMs - pacer->averageMs) * 0.05;
+    pacer->jitterMs += (deviation - pacer->jitterMs) * 0.05;
+}
+
+// Restarts the frame clock after the loop was idle, so the time spent
+// waiting for events is not counted as one long frame.
+void pacerResume(FramePacer* pacer) {
+    pacer->lastFrame = SDL_GetPerformanceCounter();
+    pacer->deadline = pacer->lastFrame + pacer->period;
+}
+
+void initFramePacing() {
+    SDL_RendererInfo info;
+    bool vsync = SDL_GetRendererInfo(renderer, &info) == 0 && (info.flags & SDL_RENDERER_PRESENTVSYNC);
+
+    if (options.fpsCap > 0) {
+        initPacer(&framePacer, PACING_CAP, options.fpsCap);
+    } else if (vsync) {
+        initPacer(&framePacer, PACING_VSYNC, 0);
+    } else if (options.vsync) {
+        // vsync was asked for but the renderer can't do it, cap to the display rate instead
+        SDL_DisplayMode mode;
+        int refresh = 60;
+        if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) == 0 && mode.refresh_rate > 0) {
+            refresh = mode.refresh_rate;
+        }
+        initPacer(&framePacer, PACING_CAP, refresh);
+    } else {
+        initPacer(&framePacer, PACING_CAP, 0);
+    }
+}
+
+void initDirtyRenderer(DirtyRenderer* dirty) {
+    SDL_RendererInfo info;
+    dirty->enabled = !options.fullRedraw && SDL_GetRendererInfo(renderer, &info) == 0 &&
+        (info.flags & SDL_RENDERER_SOFTWARE);
+}
+
+void freeDirtyRenderer(DirtyRenderer* dirty) {
+    SDL_FreeSurface(dirty->background);
+    SDL_free(dirty->tiles);
+    SDL_free(dirty->rects);
+    SDL_free(dirty->openRects);
+    *dirty = (DirtyRenderer){ 0 };
+}
+
+// Keeps a copy of the rescaled game background in the window's pixel
+// format, so restoring a tile is a plain copy.
+void setDirtyBackground(DirtyRenderer* dirty, SDL_Surface* scaled) {
+    SDL_Surface* surface = dirty->enabled && scaled ? SDL_GetWindowSurface(window) : NULL;
+    SDL_Surface* converted = surface ? SDL_ConvertSurface(scaled, surface->format, 0) : NULL;
+    if (converted) {
+        SDL_SetSurfaceBlendMode(converted, SDL_BLENDMODE_NONE);
+        SDL_FreeSurface(dirty->background);
+        dirty->background = converted;
+        dirty->valid = false;
+    }
+}
+
+// Resizes the tile map to the window surface. Anything that moves the
+// letterbox invalidates what is on screen.
+void layoutDirtyTiles(DirtyRenderer* dirty, const SDL_Surface* surface) {
+    if (dirty->width == surface->w && dirty->height == surface->h && SDL_RectEquals(&dirty->letterbox, &scene.letterbox)) {
+        return;
+    }
+    int columns = (surface->w + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+    int rows = (surface->h + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+    if (columns * rows > dirty->columns * dirty->rows) {
+        allocCheckWarmup();
+        dirty->tiles = SDL_realloc(dirty->tiles, columns * rows);
+        dirty->rects = SDL_realloc(dirty->rects, (columns * rows + 1) * sizeof(SDL_Rect));
+    }
+    if (columns > dirty->columns) {
+        allocCheckWarmup();
+        dirty->openRects = SDL_realloc(dirty->openRects, columns * sizeof(int));
+    }
+    memset(dirty->tiles, 0, columns * rows);
+    dirty->columns = columns;
+    dirty->rows = rows;
+    dirty->width = surface->w;
+    dirty->height = surface->h;
+    dirty->letterbox = scene.letterbox;
+    dirty->valid = false;
+}
+
+// Marks the tiles under [left, right) x [top, bottom) in window pixels.
+void markDirty(DirtyRenderer* dirty, int left, int top, int right, int bottom) {
+    if (left < 0) left = 0;
+    if (top < 0) top = 0;
+    if (right > dirty->width) right = dirty->width;
+    if (bottom > dirty->height) bottom = dirty->height;
+    if (left >= right || top >= bottom) {
+        return;
+    }
+    for (int row = top / DIRTY_TILE_SIZE; row <= (bottom - 1) / DIRTY_TILE_SIZE; row++) {
+        Uint8* tile = dirty->tiles + row * dirty->columns;
+        for (int column = left / DIRTY_TILE_SIZE; column <= (right - 1) / DIRTY_TILE_SIZE; column++) {
+            tile[column] |= 1;
+        }
+    }
+}
+
+void markDirtyWorld(DirtyRenderer* dirty, float x, float y, float w, float h) {
+    float scaleX = (float)dirty->letterbox.w / WORLD_WIDTH;
+    float scaleY = (float)dirty->letterbox.h / WORLD_HEIGHT;
+    markDirty(dirty,
+        dirty->letterbox.x + (int)floorf(x * scaleX) - DIRTY_PADDING,
+        dirty->letterbox.y + (int)floorf(y * scaleY) - DIRTY_PADDING,
+        dirty->letterbox.x + (int)ceilf((x + w) * scaleX) + DIRTY_PADDING,
+        dirty->letterbox.y + (int)ceilf((y + h) * scaleY) + DIRTY_PADDING);
+}
+
+// Turns the tiles drawn on this frame or the last into rectangles: one per
+// run of tiles in a row, grown downwards while the rows below repeat the
+// same run. When the old frame is gone, or most of the window changes
+// anyway, the whole window is one rectangle.
+void collectDirtyRects(DirtyRenderer* dirty) {
+    int tileCount = dirty->columns * dirty->rows;
+    int dirtyTiles = 0;
+    for (int i = 0; i < tileCount; i++) {
+        dirtyTiles += dirty->tiles[i] != 0;
+    }
+    dirty->rectCount = 0;
+    if (!dirty->valid || dirtyTiles * 2 > tileCount) {
+        dirty->rects[dirty->rectCount++] = (SDL_Rect){ 0, 0, dirty->width, dirty->height };
+        return;
+    }
+    for (int column = 0; column < dirty->columns; column++) {
+        dirty->openRects[column] = -1;
+    }
+    for (int row = 0; row < dirty->rows; row++) {
+        const Uint8* tile = dirty->tiles + row * dirty->columns;
+        for (int column = 0; column < dirty->columns; column++) {
+            if (!tile[column]) {
+                continue;
+            }
+            int start = column;
+            while (column + 1 < dirty->columns && tile[column + 1]) column++;
+            SDL_Rect rect = { start * DIRTY_TILE_SIZE, row * DIRTY_TILE_SIZE,
+                (column + 1 - start) * DIRTY_TILE_SIZE, DIRTY_TILE_SIZE };
+            if (rect.x + rect.w > dirty->width) rect.w = dirty->width - rect.x;
+            if (rect.y + rect.h > dirty->height) rect.h = dirty->height - rect.y;
+
+            int open = dirty->openRects[start];
+            SDL_Rect* above = open >= 0 ? &dirty->rects[open] : NULL;
+            if (above && above->w == rect.w && above->y + above->h == rect.y) {
+                above->h += rect.h;
+            } else {
+                dirty->openRects[start] = dirty->rectCount;
+                dirty->rects[dirty->rectCount++] = rect;
+            }
+        }
+    }
+}
+
+// Puts back what is under a rectangle before anything is drawn on it: the
+// cached background inside the letterbox, black around it.
+void restoreDirtyRect(DirtyRenderer* dirty, SDL_Surface* surface, const SDL_Rect* rect) {
+    SDL_Rect inside;
+    bool overlaps = SDL_IntersectRect(rect, &dirty->letterbox, &inside);
+    if (!overlaps || !SDL_RectEquals(&inside, rect)) {
+        SDL_FillRect(surface, rect, SDL_MapRGB(surface->format, 0, 0, 0));
+    }
+    if (overlaps) {
+        SDL_Rect source = { inside.x - dirty->letterbox.x, inside.y - dirty->letterbox.y, inside.w, inside.h };
+        SDL_BlitSurface(dirty->background, &source, surface, &inside);
+    }
+}
+
+void presentDirtyFrame(DirtyRenderer* dirty) {
+    SDL_RenderFlush(renderer);
+    SDL_UpdateWindowSurfaceRects(window, dirty->rects, dirty->rectCount);
+    for (int i = 0; i < dirty->rectCount; i++) {
+        dirty->redrawnPixels += (Uint64)dirty->rects[i].w * dirty->rects[i].h;
+    }
+    dirty->framePixels += (Uint64)dirty->width * dirty->height;
+    // what was drawn on this frame has to be erased on the next
+    for (int i = 0; i < dirty->columns * dirty->rows; i++) {
+        dirty->tiles[i] = (Uint8)((dirty->tiles[i] & 1) << 1);
+    }
+    dirty->valid = true;
+    dirty->pending = false;
+}
+
+void presentFrame() {
+    if (dirtyRenderer.pending) {
+        presentDirtyFrame(&dirtyRenderer);
+    } else {
+        SDL_RenderPresent(renderer);
+        dirtyRenderer.valid = false;
+    }
+    lastFrameDrawCalls = drawCallCount;
+    drawCallCount = 0;
+}
+
+void drawTexture(SDL_Texture* texture, const SDL_Rect* src, const SDL_Rect* dst) {
+    drawCallCount++;
+    SDL_RenderCopy(renderer, texture, src, dst);
+}
+
+void drawGeometry(SDL_Texture* texture, const SDL_Vertex* vertices, int vertexCount,
+const int* indices, int indexCount) {
+    drawCallCount++;
+    SDL_RenderGeometry(renderer, texture, vertices, vertexCount, indices, indexCount);
+}
+
+// Fits the fixed-size world into the window, keeping its aspect ratio, and
+// remakes the offscreen target when the window size changes. The target is
+// the size of the letterbox at native resolution; lower render scales only
+// use its top-left corner, so changing the scale never reallocates it.
+void updateSceneLayout() {
+    int outputWidth, outputHeight;
+    if (SDL_GetRendererOutputSize(renderer, &outputWidth, &outputHeight) != 0 || outputWidth <= 0 || outputHeight <= 0) {
+        return;
+    }
+    SDL_Rect box = { 0, 0, outputWidth, outputWidth * WORLD_HEIGHT / WORLD_WIDTH };
+    if (box.h > outputHeight) {
+        box.h = outputHeight;
+        box.w = outputHeight * WORLD_WIDTH / WORLD_HEIGHT;
+    }
+    box.x = (outputWidth - box.w) / 2;
+    box.y = (outputHeight - box.h) / 2;
+    scene.letterbox = box;
+    scene.outputWidth = outputWidth;
+    scene.outputHeight = outputHeight;
+
+    if (scene.useTarget && (!scene.target || scene.targetWidth != box.w || scene.targetHeight != box.h)) {
+        allocCheckWarmup();
+        SDL_DestroyTexture(scene.target);
+        scene.target = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, box.w, box.h);
+        if (scene.target) {
+            SDL_SetTextureScaleMode(scene.target, SDL_ScaleModeLinear);
+        } else {
+            scene.useTarget = false;
+        }
+        scene.targetWidth = box.w;
+        scene.targetHeight = box.h;
+    }
+
+    int scaled = (int)(box.w * scene.scale + 0.5f);
+    scene.view = (SDL_Rect){ 0, 0, scaled > 0 ? scaled : 1, (int)(box.h * scene.scale + 0.5f) };
+    if (scene.view.h < 1) scene.view.h = 1;
+}
+
+void initScene() {
+    // the software path draws straight into the window at full resolution
+    scene.useTarget = SDL_RenderTargetSupported(renderer) && !dirtyRenderer.enabled;
+    scene.autoScale = options.renderScale == 0 && !dirtyRenderer.enabled;
+    scene.scale = scene.autoScale || dirtyRenderer.enabled ? 1.0f : options.renderScale / 100.0f;
+    scene.ceiling = 1.0f;
+    scene.lastChange = SDL_GetTicks();
+
+    SDL_DisplayMode mode;
+    int refresh = 60;
+    if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) == 0 && mode.refresh_rate > 0) {
+        refresh = mode.refresh_rate;
+    }
+    scene.budgetMs = framePacer.period > 0 ?
+        (double)framePacer.period * 1000.0 / SDL_GetPerformanceFrequency() : 1000.0 / refresh;
+    updateSceneLayout();
+}
+
+// Everything drawn until endScene() is in world coordinates and lands in
+// the offscreen target at the current render scale.
+void beginScene() {
+    updateSceneLayout();
+    if (scene.useTarget) {
+        SDL_SetRenderTarget(renderer, scene.target);
+        SDL_RenderSetViewport(renderer, &scene.view);
+        SDL_RenderSetScale(renderer, (float)scene.view.w / WORLD_WIDTH, (float)scene.view.h / WORLD_HEIGHT);
+    } else {
+        SDL_RenderSetViewport(renderer, &scene.letterbox);
+        SDL_RenderSetScale(renderer, (float)scene.letterbox.w / WORLD_WIDTH, (float)scene.letterbox.h / WORLD_HEIGHT);
+    }
+}
+
+// Back to window coordinates, with the scene upscaled into the letterbox in one copy.
+void endScene() {
+    if (scene.useTarget) {
+        SDL_SetRenderTarget(renderer, NULL);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        SDL_RenderClear(renderer);
+        drawTexture(scene.target, &scene.view, &scene.letterbox);
+    } else {
+        SDL_RenderSetScale(renderer, 1.0f, 1.0f);
+        SDL_RenderSetViewport(renderer, NULL);
+    }
+}
+
+void windowToWorld(int x, int y, float* worldX, float* worldY) {
+    float pixelX = (float)x * scene.outputWidth / SCREEN_WIDTH;
+    float pixelY = (float)y * scene.outputHeight / SCREEN_HEIGHT;
+    *worldX = roundf((pixelX - scene.letterbox.x) * WORLD_WIDTH / scene.letterbox.w * REPLAY_AIM_SCALE) / REPLAY_AIM_SCALE;
+    *worldY = roundf((pixelY - scene.letterbox.y) * WORLD_HEIGHT / scene.letterbox.h * REPLAY_AIM_SCALE) / REPLAY_AIM_SCALE;
+}
+
+// Lowers the render scale when frames run over budget and raises it again
+// once they have stayed comfortably within it. With vsync the present
+// blocks until the display is ready, so only missed frames show up in the
+// frame time; without it the time spent rendering is compared directly.
+void updateRenderScale(double frameMs, double busyMs) {
+    if (!scene.autoScale || !scene.useTarget) {
+        return;
+    }
+    bool vsync = framePacer.mode == PACING_VSYNC;
+    double load = (vsync ? frameMs : busyMs) / scene.budgetMs;
+    scene.load += (load - scene.load) * 0.1;
+
+    Uint32 now = SDL_GetTicks();
+    if (now - scene.lastChange < RENDER_SCALE_SETTLE_MS) {
+        return;
+    }
+    if (scene.load > (vsync ? 1.1 : 0.9) && scene.scale > RENDER_SCALE_MIN) {
+        // don't come back up to a scale that was already too slow for a while
+        scene.ceiling = scene.scale;
+        scene.scale *= RENDER_SCALE_STEP_DOWN;
+        if (scene.scale < RENDER_SCALE_MIN) scene.scale = RENDER_SCALE_MIN;
+        scene.lastChange = now;
+        scene.load = vsync ? 1.0 : 0.75;
+    } else if (scene.load < (vsync ? 1.02 : 0.6) && now - scene.lastChange >= RENDER_SCALE_RAISE_MS) {
+        scene.ceiling = scene.ceiling + 0.05f < 1.0f ? scene.ceiling + 0.05f : 1.0f;
+        if (scene.scale < scene.ceiling) {
+            scene.scale = scene.scale * RENDER_SCALE_STEP_UP < scene.ceiling ? scene.scale * RENDER_SCALE_STEP_UP : scene.ceiling;
+        }
+        scene.lastChange = now;
+    }
+}
+
+// Source taps and weights for each output pixel along one axis: an area
+// average when shrinking, linear interpolation when enlarging.
+float* buildResampleFilter(int sourceSize, int targetSize, int* first, int* taps) {
+    float scale = (float)sourceSize / targetSize;
+    *taps = scale > 1.0f ? (int)ceilf(scale) + 1 : 2;
+    float* weights = SDL_calloc((size_t)targetSize * *taps, sizeof(float));
+    if (!weights) {
+        return NULL;
+    }
+    for (int i = 0; i < targetSize; i++) {
+        float* w = weights + i * *taps;
+        if (scale > 1.0f) {
+            float start = i * scale, end = start + scale;
+            first[i] = (int)start;
+            for (int t = 0; t < *taps; t++) {
+                float low = start > first[i] + t ? start : first[i] + t;
+                float high = end < first[i] + t + 1 ? end : first[i] + t + 1;
+                w[t] = high > low ? (high - low) / scale : 0.0f;
+            }
+        } else {
+            float center = (i + 0.5f) * scale - 0.5f;
+            if (center < 0) center = 0;
+            first[i] = (int)center;
+            w[0] = 1.0f - (center - first[i]);
+            w[1] = center - first[i];
+        }
+    }
+    return weights;
+}
+
+// Returns a new RGBA32 copy of the image at width x height. Filtering is
+// done on premultiplied color, so transparent pixels do not bleed dark
+// fringes into sprite edges. Safe to call from any thread.
+SDL_Surface* resampleImage(SDL_Surface* image, int width, int height) {
+    SDL_Surface* source = SDL_ConvertSurfaceFormat(image, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_Surface* target = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGBA32);
+    int* firstX = SDL_malloc(width * sizeof(int));
+    int* firstY = SDL_malloc(height * sizeof(int));
+    float* row = source ? SDL_malloc((size_t)source->w * 4 * sizeof(float)) : NULL;
+    int tapsX = 0, tapsY = 0;
+    float* weightsX = source && firstX ? buildResampleFilter(source->w, width, firstX, &tapsX) : NULL;
+    float* weightsY = source && firstY ? buildResampleFilter(source->h, height, firstY, &tapsY) : NULL;
+
+    if (target && row && weightsX && weightsY) {
+        for (int y = 0; y < height; y++) {
+            // vertical pass into one premultiplied row, then horizontal into the target
+            memset(row, 0, (size_t)source->w * 4 * sizeof(float));
+            for (int t = 0; t < tapsY; t++) {
+                float weight = weightsY[y * tapsY + t];
+                int sy = firstY[y] + t < source->h ? firstY[y] + t : source->h - 1;
+                if (weight == 0.0f) continue;
+                const Uint8* in = (const Uint8*)source->pixels + sy * source->pitch;
+                for (int x = 0; x < source->w; x++) {
+                    float alpha = in[x * 4 + 3] * weight;
+                    row[x * 4 + 0] += in[x * 4 + 0] * alpha;
+                    row[x * 4 + 1] += in[x * 4 + 1] * alpha;
+                    row[x * 4 + 2] += in[x * 4 + 2] * alpha;
+                    row[x * 4 + 3] += alpha;
+                }
+            }
+            Uint8* out = (Uint8*)target->pixels + y * target->pitch;
+            for (int x = 0; x < width; x++) {
+                float sum[4] = { 0 };
+                for (int t = 0; t < tapsX; t++) {
+                    float weight = weightsX[x * tapsX + t];
+                    int sx = firstX[x] + t < source->w ? firstX[x] + t : source->w - 1;
+                    for (int c = 0; c < 4; c++) sum[c] += row[sx * 4 + c] * weight;
+                }
+                float alpha = sum[3];
+                for (int c = 0; c < 3; c++) {
+                    float value = alpha > 0.0f ? sum[c] / alpha : 0.0f;
+                    out[x * 4 + c] = (Uint8)(value > 255.0f ? 255 : value + 0.5f);
+                }
+                out[x * 4 + 3] = (Uint8)(alpha > 255.0f ? 255 : alpha + 0.5f);
+            }
+        }
+    } else {
+        SDL_FreeSurface(target);
+        target = NULL;
+    }
+
+    SDL_free(weightsX);
+    SDL_free(weightsY);
+    SDL_free(row);
+    SDL_free(firstX);
+    SDL_free(firstY);
+    SDL_FreeSurface(source);
+    return target;
+}
+
+// Packs the sprites side by side into one texture, plus a small white block
+// whose center is sampled for solid-color quads. The images stay owned by
+// the caller; missing ones are left blank.
+bool buildSpriteAtlas(SpriteAtlas* atlas, SDL_Surface* images[]) {
+    SDL_Rect placed[SPRITE_COUNT];
+    int width = 0, height = 0;
+
+    for (int i = 0; i < SPRITE_COUNT; i++) {
+        int w = SPRITE_WHITE_SIZE, h = SPRITE_WHITE_SIZE;
+        if (i != SPRITE_WHITE) {
+            w = images[i] ? images[i]->w : 0;
+            h = images[i] ? images[i]->h : 0;
+        }
+        placed[i] = (SDL_Rect){ width, 0, w, h };
+        width += w + 1;
+        if (h > height) height = h;
+    }
+
+    atlas->texture = NULL;
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (surface) {
+        SDL_FillRect(surface, NULL, SDL_MapRGBA(surface->format, 0, 0, 0, 0));
+        for (int i = 0; i < SPRITE_COUNT; i++) {
+            SDL_Rect dst = placed[i];
+            if (i == SPRITE_WHITE) {
+                SDL_FillRect(surface, &dst, SDL_MapRGBA(surface->format, 255, 255, 255, 255));
+            } else if (i != SPRITE_WHITE && images[i]) {
+                SDL_SetSurfaceBlendMode(images[i], SDL_BLENDMODE_NONE);
+                SDL_BlitSurface(images[i], NULL, surface, &dst);
+            }
+        }
+        atlas->texture = SDL_CreateTextureFromSurface(renderer, surface);
+        SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+        SDL_FreeSurface(surface);
+    }
+
+    for (int i = 0; i < SPRITE_COUNT; i++) {
+        atlas->uv[i] = (SDL_FRect){
+            (float)placed[i].x / width, (float)placed[i].y / height,
+            (float)placed[i].w / width, (float)placed[i].h / height
+        };
+    }
+    // sample only the middle of the white block so filtering never reaches the border
+    atlas->uv[SPRITE_WHITE] = (SDL_FRect){
+        (placed[SPRITE_WHITE].x + SPRITE_WHITE_SIZE / 2.0f) / width,
+        (SPRITE_WHITE_SIZE / 2.0f) / height, 0, 0
+    };
+    return atlas->texture != NULL;
+}
+
+void reserveBatch(SpriteBatch* batch, int quads) {
+    if (quads <= batch->quadCapacity) {
+        return;
+    }
+    int capacity = batch->quadCapacity ? batch->quadCapacity : 256;
+    while (capacity < quads) capacity *= 2;
+    batch->vertices = SDL_realloc(batch->vertices, capacity * 4 * sizeof(SDL_Vertex));
+    batch->indices = SDL_realloc(batch->indices, capacity * 6 * sizeof(int));
+    for (int i = batch->quadCapacity; i < capacity; i++) {
+        batch->indices[i * 6 + 0] = i * 4 + 0;
+        batch->indices[i * 6 + 1] = i * 4 + 1;
+        batch->indices[i * 6 + 2] = i * 4 + 2;
+        batch->indices[i * 6 + 3] = i * 4 + 2;
+        batch->indices[i * 6 + 4] = i * 4 + 1;
+        batch->indices[i * 6 + 5] = i * 4 + 3;
+    }
+    batch->quadCapacity = capacity;
+}
+
+void freeBatch(SpriteBatch* batch) {
+    SDL_free(batch->vertices);
+    SDL_free(batch->indices);
+    *batch = (SpriteBatch){ 0 };
+}
+
+void batchSprite(SpriteBatch* batch, int sprite, float x, float y, float w, float h, SDL_Color color) {
+    reserveBatch(batch, batch->quadCount + 1);
+    const SDL_FRect* uv = &spriteAtlas.uv[sprite];
+    SDL_Vertex* v = &batch->vertices[batch->quadCount * 4];
+    v[0] = (SDL_Vertex){ { x, y }, color, { uv->x, uv->y } };
+    v[1] = (SDL_Vertex){ { x + w, y }, color, { uv->x + uv->w, uv->y } };
+    v[2] = (SDL_Vertex){ { x, y + h }, color, { uv->x, uv->y + uv->h } };
+    v[3] = (SDL_Vertex){ { x + w, y + h }, color, { uv->x + uv->w, uv->y + uv->h } };
+    batch->quadCount++;
+}
+
+void flushBatch(SpriteBatch* batch) {
+    if (batch->quadCount > 0 && spriteAtlas.texture) {
+        drawGeometry(spriteAtlas.texture, batch->vertices, batch->quadCount * 4,
+            batch->indices, batch->quadCount * 6);
+    }
+    batch->quadCount = 0;
+}
+
+void renderBullets(SpriteBatch* batch, const WorldSnapshot* snapshot) {
+    SDL_Color yellow = { 255, 255, 0, 255 };
+    for (int i = 0; i < snapshot->bulletCount; i++) {
+        batchSprite(batch, SPRITE_WHITE, (int)snapshot->bulletX[i] - BULLET_SIZE / 2,
+            (int)snapshot->bulletY[i] - BULLET_SIZE / 2, BULLET_SIZE, BULLET_SIZE, yellow);
+    }
+}
+
+void reserveParticles(ParticlePool* pool, int capacity) {
+    if (capacity <= pool->capacity) {
+        return;
+    }
+    pool->x = SDL_realloc(pool->x, capacity * sizeof(float));
+    pool->y = SDL_realloc(pool->y, capacity * sizeof(float));
+    pool->vx = SDL_realloc(pool->vx, capacity * sizeof(float));
+    pool->vy = SDL_realloc(pool->vy, capacity * sizeof(float));
+    pool->life = SDL_realloc(pool->life, capacity * sizeof(float));
+    pool->fade = SDL_realloc(pool->fade, capacity * sizeof(float));
+    pool->color = SDL_realloc(pool->color, capacity * sizeof(SDL_Color));
+    pool->capacity = capacity;
+}
+
+void freeParticlePool(ParticlePool* pool) {
+    SDL_free(pool->x);
+    SDL_free(pool->y);
+    SDL_free(pool->vx);
+    SDL_free(pool->vy);
+    SDL_free(pool->life);
+    SDL_free(pool->fade);
+    SDL_free(pool->color);
+    *pool = (ParticlePool){ 0 };
+}
+
+// Scalar update of [start, count), also used for the SIMD kernels' tails.
+void integrateParticleRange(ParticlePool* pool, int start, float dt, float damping) {
+    for (int i = start; i < pool->count; i++) {
+        pool->x[i] += pool->vx[i] * dt;
+        pool->y[i] += pool->vy[i] * dt;
+        pool->vx[i] *= damping;
+        pool->vy[i] *= damping;
+        pool->life[i] -= pool->fade[i] * dt;
+    }
+}
+
+void integrateParticlesScalar(ParticlePool* pool, float dt, float damping) {
+    integrateParticleRange(pool, 0, dt, damping);
+}
+
+#ifdef COTL_SSE2
+void integrateParticlesSSE2(ParticlePool* pool, float dt, float damping) {
+    __m128 vdt = _mm_set1_ps(dt);
+    __m128 vdamping = _mm_set1_ps(damping);
+    int i = 0;
+    for (; i + 4 <= pool->count; i += 4) {
+        __m128 vx = _mm_loadu_ps(pool->vx + i);
+        __m128 vy = _mm_loadu_ps(pool->vy + i);
+        _mm_storeu_ps(pool->x + i, _mm_add_ps(_mm_loadu_ps(pool->x + i), _mm_mul_ps(vx, vdt)));
+        _mm_storeu_ps(pool->y + i, _mm_add_ps(_mm_loadu_ps(pool->y + i), _mm_mul_ps(vy, vdt)));
+        _mm_storeu_ps(pool->vx + i, _mm_mul_ps(vx, vdamping));
+        _mm_storeu_ps(pool->vy + i, _mm_mul_ps(vy, vdamping));
+        _mm_storeu_ps(pool->life + i, _mm_sub_ps(_mm_loadu_ps(pool->life + i),
+            _mm_mul_ps(_mm_loadu_ps(pool->fade + i), vdt)));
+    }
+    integrateParticleRange(pool, i, dt, damping);
+}
+#endif
+
+#ifdef COTL_AVX2
+__attribute__((target("avx2")))
+void integrateParticlesAVX2(ParticlePool* pool, float dt, float damping) {
+    __m256 vdt = _mm256_set1_ps(dt);
+    __m256 vdamping = _mm256_set1_ps(damping);
+    int i = 0;
+    for (; i + 8 <= pool->count; i += 8) {
+        __m256 vx = _mm256_loadu_ps(pool->vx + i);
+        __m256 vy = _mm256_loadu_ps(pool->vy + i);
+        _mm256_storeu_ps(pool->x + i, _mm256_add_ps(_mm256_loadu_ps(pool->x + i), _mm256_mul_ps(vx, vdt)));
+        _mm256_storeu_ps(pool->y + i, _mm256_add_ps(_mm256_loadu_ps(pool->y + i), _mm256_mul_ps(vy, vdt)));
+        _mm256_storeu_ps(pool->vx + i, _mm256_mul_ps(vx, vdamping));
+        _mm256_storeu_ps(pool->vy + i, _mm256_mul_ps(vy, vdamping));
+        _mm256_storeu_ps(pool->life + i, _mm256_sub_ps(_mm256_loadu_ps(pool->life + i),
+            _mm256_mul_ps(_mm256_loadu_ps(pool->fade + i), vdt)));
+    }
+    _mm256_zeroupper();  // gcc skips it on the tail call, leaving every later SSE op paying for dirty state
+    integrateParticleRange(pool, i, dt, damping);
+}
+#endif
+
+void selectParticleKernel() {
+    integrateParticles = integrateParticlesScalar;
+#ifdef COTL_SSE2
+    integrateParticles = integrateParticlesSSE2;
+#endif
+#ifdef COTL_AVX2
+    if (SDL_HasAVX2()) {
+        integrateParticles = integrateParticlesAVX2;
+    }
+#endif
+}
+
+void expireParticles(ParticlePool* pool) {
+    int i = 0;
+    while (i < pool->count) {
+        if (pool->life[i] > 0) {
+            i++;
+            continue;
+        }
+        int last = --pool->count;
+        pool->x[i] = pool->x[last];
+        pool->y[i] = pool->y[last];
+        pool->vx[i] = pool->vx[last];
+        pool->vy[i] = pool->vy[last];
+        pool->life[i] = pool->life[last];
+        pool->fade[i] = pool->fade[last];
+        pool->color[i] = pool->color[last];
+    }
+}
+
+// Everything is allocated up front so emitting never allocates; the sprite
+// batch is grown to fit a full layer too.
+void initParticles(ParticleSystem* system) {
+    for (int layer = 0; layer < PARTICLE_LAYER_COUNT; layer++) {
+        reserveParticles(&system->layers[layer], MAX_PARTICLES);
+    }
+    reserveBatch(&spriteBatch, MAX_PARTICLES);
+    system->rng = (Rng){ launchCounter };
+}
+
+void resetParticles(ParticleSystem* system) {
+    for (int layer = 0; layer < PARTICLE_LAYER_COUNT; layer++) {
+        system->layers[layer].count = 0;
+    }
+    system->trailStarted = false;
+    system->trailCarry = 0;
+}
+
+void freeParticles(ParticleSystem* system) {
+    for (int layer = 0; layer < PARTICLE_LAYER_COUNT; layer++) {
+        freeParticlePool(&system->layers[layer]);
+    }
+}
+
+// Launches one particle in a random direction at up to 1.5x speed. Dropped
+// once the frame's budget or the layer is used up.
+void emitParticle(ParticleSystem* system, int layer, float x, float y, float speed, float lifetime, SDL_Color color) {
+    ParticlePool* pool = &system->layers[layer];
+    if (system->budget <= 0 || pool->count == pool->capacity) {
+        return;
+    }
+    system->budget--;
+    float angle = rngUnit(&system->rng) * 2.0f * (float)PI;
+    speed *= 0.5f + rngUnit(&system->rng);
+    int i = pool->count++;
+    pool->x[i] = x;
+    pool->y[i] = y;
+    pool->vx[i] = cosf(angle) * speed;
+    pool->vy[i] = sinf(angle) * speed;
+    pool->life[i] = 1.0f;
+    pool->fade[i] = 1.0f / (lifetime * (0.75f + 0.5f * rngUnit(&system->rng)));
+    pool->color[i] = color;
+}
+
+// The budget is shared out evenly, so a frame with more kills than it can
+// afford gives each of them a smaller burst rather than skipping some.
+void emitKillBursts(ParticleSystem* system, const KillEvents* kills) {
+    SDL_Color debris = { 170, 20, 20, 255 };
+    SDL_Color spark = { 255, 170, 60, 255 };
+    for (int k = 0; k < kills->count; k++) {
+        int burst = system->budget / (kills->count - k);
+        if (burst > PARTICLE_BURST) burst = PARTICLE_BURST;
+        for (int i = 0; i < burst; i++) {
+            if (i % 2 == 0) {
+                emitParticle(system, PARTICLES_BLEND, kills->x[k], kills->y[k], 90.0f, 0.6f, debris);
+            } else {
+                emitParticle(system, PARTICLES_ADDITIVE, kills->x[k], kills->y[k], 220.0f, 0.35f, spark);
+            }
+        }
+    }
+}
+
+// Fills in the path the fireball took since the last frame at a steady rate.
+void emitTrail(ParticleSystem* system, float x, float y, float dt) {
+    SDL_Color ember = { 255, 110, 30, 200 };
+    if (!system->trailStarted) {
+        system->trailX = x;
+        system->trailY = y;
+        system->trailStarted = true;
+    }
+    system->trailCarry += PARTICLE_TRAIL_RATE * dt;
+    int count = (int)system->trailCarry;
+    system->trailCarry -= count;
+    for (int i = 0; i < count; i++) {
+        float t = (i + 1.0f) / count;
+        emitParticle(system, PARTICLES_ADDITIVE, system->trailX + (x - system->trailX) * t,
+            system->trailY + (y - system->trailY) * t, 15.0f, 0.3f, ember);
+    }
+    system->trailX = x;
+    system->trailY = y;
+}
+
+// Ages every particle by dt, then adds this frame's bursts and trail.
+void updateParticles(ParticleSystem* system, const WorldSnapshot* snapshot, float dt) {
+    float damping = expf(-PARTICLE_DRAG * dt);
+    for (int layer = 0; layer < PARTICLE_LAYER_COUNT; layer++) {
+        integrateParticles(&system->layers[layer], dt, damping);
+        expireParticles(&system->layers[layer]);
+    }
+    system->budget = PARTICLE_FRAME_BUDGET;
+    emitKillBursts(system, &snapshot->kills);
+    emitTrail(system, snapshot->redDotX, snapshot->redDotY, dt);
+}
+
+// One geometry submission per layer, each with the atlas switched to that
+// layer's blend mode.
+void renderParticles(const ParticleSystem* system) {
+    static const SDL_BlendMode blendModes[PARTICLE_LAYER_COUNT] = { SDL_BLENDMODE_BLEND, SDL_BLENDMODE_ADD };
+    if (!spriteAtlas.texture) {
+        return;
+    }
+    const SDL_FRect* uv = &spriteAtlas.uv[SPRITE_WHITE];
+    SDL_FPoint texel = { uv->x + uv->w / 2, uv->y + uv->h / 2 };
+    float half = PARTICLE_SIZE / 2.0f;
+    for (int layer = 0; layer < PARTICLE_LAYER_COUNT; layer++) {
+        const ParticlePool* pool = &system->layers[layer];
+        if (pool->count == 0) {
+            continue;
+        }
+        reserveBatch(&spriteBatch, pool->count);  // drawn before anything else is batched
+        SDL_Vertex* v = spriteBatch.vertices;
+        for (int i = 0; i < pool->count; i++, v += 4) {
+            SDL_Color color = pool->color[i];
+            color.a = (Uint8)(color.a * pool->life[i]);
+            float x = pool->x[i] - half;
+            float y = pool->y[i] - half;
+            v[0] = (SDL_Vertex){ { x, y }, color, texel };
+            v[1] = (SDL_Vertex){ { x + PARTICLE_SIZE, y }, color, texel };
+            v[2] = (SDL_Vertex){ { x, y + PARTICLE_SIZE }, color, texel };
+            v[3] = (SDL_Vertex){ { x + PARTICLE_SIZE, y + PARTICLE_SIZE }, color, texel };
+        }
+        spriteBatch.quadCount = pool->count;
+        SDL_SetTextureBlendMode(spriteAtlas.texture, blendModes[layer]);
+        flushBatch(&spriteBatch);
+    }
+    SDL_SetTextureBlendMode(spriteAtlas.texture, SDL_BLENDMODE_BLEND);
+}
+
+void synthesizeSound(Sample* sample, const SoundRecipe* recipe) {
+    Rng rng = { 0x5EED };
+    sample->frames = (int)(recipe->seconds * AUDIO_FREQUENCY);
+    sample->samples = SDL_malloc(sample->frames * sizeof(float));
+    float phase = 0;
+    for (int i = 0; i < sample->frames; i++) {
+        float t = (float)i / AUDIO_FREQUENCY;
+        float hz = recipe->startHz * powf(recipe->endHz / recipe->startHz, t / recipe->seconds);
+        phase += hz / AUDIO_FREQUENCY;
+        phase -= floorf(phase);
+        float tone = sinf(2.0f * (float)PI * phase);
+        float noise = rngUnit(&rng) * 2.0f - 1.0f;
+        float attack = t < 0.002f ? t / 0.002f : 1.0f;  // no click at the start
+        float release = (float)(sample->frames - i) / (AUDIO_FREQUENCY * 0.01f);
+        float envelope = attack * expf(-recipe->decay * t) * (release < 1.0f ? release : 1.0f);
+        sample->samples[i] = (tone * (1.0f - recipe->noise) + noise * recipe->noise) * envelope;
+    }
+}
+
+// Any format SDL can read is converted to the mixer's own up front.
+bool loadSoundFile(Sample* sample, const char* path) {
+    SDL_AudioSpec spec;
+    Uint8* data;
+    Uint32 length;
+    if (!SDL_LoadWAV(path, &spec, &data, &length)) {
+        return false;
+    }
+    SDL_AudioCVT cvt;
+    if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq, AUDIO_F32SYS, 1, AUDIO_FREQUENCY) < 0) {
+        SDL_FreeWAV(data);
+        return false;
+    }
+    cvt.len = (int)length;
+    cvt.buf = SDL_malloc((size_t)length * cvt.len_mult);
+    memcpy(cvt.buf, data, length);
+    SDL_FreeWAV(data);
+    if (SDL_ConvertAudio(&cvt) != 0) {
+        SDL_free(cvt.buf);
+        return false;
+    }
+    sample->samples = (float*)cvt.buf;
+    sample->frames = cvt.len_cvt / (int)sizeof(float);
+    return true;
+}
+
+// Adds a mono sample into interleaved stereo with a gain per channel.
+void mixVoice(float* out, const float* in, int frames, float left, float right) {
+    int i = 0;
+#ifdef COTL_SSE2
+    __m128 gains = _mm_setr_ps(left, right, left, right);
+    for (; i + 4 <= frames; i += 4) {
+        __m128 mono = _mm_loadu_ps(in + i);
+        __m128 first = _mm_mul_ps(_mm_unpacklo_ps(mono, mono), gains);
+        __m128 second = _mm_mul_ps(_mm_unpackhi_ps(mono, mono), gains);
+        _mm_storeu_ps(out + 2 * i, _mm_add_ps(_mm_loadu_ps(out + 2 * i), first));
+        _mm_storeu_ps(out + 2 * i + 4, _mm_add_ps(_mm_loadu_ps(out + 2 * i + 4), second));
+    }
+#endif
+    for (; i < frames; i++) {
+        out[2 * i] += in[i] * left;
+        out[2 * i + 1] += in[i] * right;
+    }
+}
+
+void clipAudio(float* out, int count) {
+    int i = 0;
+#ifdef COTL_SSE2
+    __m128 low = _mm_set1_ps(-1.0f);
+    __m128 high = _mm_set1_ps(1.0f);
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(out + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(out + i), low), high));
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = out[i] < -1.0f ? -1.0f : out[i] > 1.0f ? 1.0f : out[i];
+    }
+}
+
+// Audio thread: with every voice busy the oldest one is cut off.
+void startVoice(AudioMixer* mixer, const AudioCommand* command) {
+    const Sample* sample = &mixer->samples[command->sound];
+    if (sample->frames == 0) {
+        return;
+    }
+    Voice* voice = &mixer->voices[0];
+    for (int i = 0; i < AUDIO_VOICES; i++) {
+        if (!mixer->voices[i].sample) {
+            voice = &mixer->voices[i];
+            break;
+        }
+        if ((Sint32)(mixer->voices[i].started - voice->started) < 0) {
+            voice = &mixer->voices[i];
+        }
+    }
+    if (voice->sample) {
+        SDL_AtomicAdd(&mixer->steals, 1);
+    }
+    float volume = command->volume * AUDIO_MASTER_VOLUME;
+    float pan = command->pan < -1.0f ? -1.0f : command->pan > 1.0f ? 1.0f : command->pan;
+    *voice = (Voice){ sample, 0, volume * (pan > 0 ? 1.0f - pan : 1.0f),
+        volume * (pan < 0 ? 1.0f + pan : 1.0f), mixer->voiceClock++ };
+}
+
+void SDLCALL mixAudio(void* userdata, Uint8* stream, int length) {
+    AudioMixer* mixer = userdata;
+    int tail = SDL_AtomicGet(&mixer->tail);
+    int head = SDL_AtomicGet(&mixer->head);
+    SDL_MemoryBarrierAcquire();  // commands written before head moved are visible
+    for (; tail != head; tail++) {
+        startVoice(mixer, &mixer->queue[tail & (AUDIO_QUEUE_SIZE - 1)]);
+    }
+    SDL_AtomicSet(&mixer->tail, tail);
+
+    float* out = (float*)stream;
+    int frames = length / (int)(2 * sizeof(float));
+    memset(stream, 0, length);
+    for (int i = 0; i < AUDIO_VOICES; i++) {
+        Voice* voice = &mixer->voices[i];
+        if (!voice->sample) {
+            continue;
+        }
+        int count = voice->sample->frames - voice->position;
+        if (count > frames) count = frames;
+        mixVoice(out, voice->sample->samples + voice->position, count, voice->left, voice->right);
+        voice->position += count;
+        if (voice->position >= voice->sample->frames) {
+            voice->sample = NULL;
+        }
+    }
+    clipAudio(out, frames * 2);
+}
+
+// Game thread: queues a sound for the next callback. Dropped, not waited
+// on, when the audio thread has fallen a whole queue behind.
+void playSound(AudioMixer* mixer, int sound, float volume, float pan) {
+    if (!mixer->device) {
+        return;
+    }
+    int head = SDL_AtomicGet(&mixer->head);
+    if (head - SDL_AtomicGet(&mixer->tail) >= AUDIO_QUEUE_SIZE) {
+        SDL_AtomicAdd(&mixer->dropped, 1);
+        return;
+    }
+    mixer->queue[head & (AUDIO_QUEUE_SIZE - 1)] = (AudioCommand){ sound, volume, pan };
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&mixer->head, head + 1);
+}
+
+float worldPan(float x) {
+    return x / WORLD_WIDTH * 2.0f - 1.0f;
+}
+
+// What a frame's snapshot says happened, turned into sounds. Big waves
+// kill far more enemies per frame than are worth hearing, so only a few
+// kills start a sound, a little louder when there were many.
+void playFrameSounds(AudioMixer* mixer, const WorldSnapshot* snapshot) {
+    const KillEvents* kills = &snapshot->kills;
+    int audible = kills->count < AUDIO_KILL_SOUNDS ? kills->count : AUDIO_KILL_SOUNDS;
+    float killVolume = kills->count > AUDIO_KILL_SOUNDS ? 0.8f : 0.6f;
+    for (int i = 0; i < audible; i++) {
+        int k = i * kills->count / audible;  // spread over the frame's kills
+        playSound(mixer, SOUND_KILL, killVolume, worldPan(kills->x[k]));
+    }
+    if (snapshot->volleys > 0) {
+        playSound(mixer, SOUND_SHOT, 0.5f, worldPan(snapshot->player.x + PLAYER_SIZE / 2));
+    }
+    if (snapshot->player.hp < mixer->lastHp) {
+        playSound(mixer, SOUND_HURT, 0.9f, 0);
+    }
+    mixer->lastHp = snapshot->player.hp;
+}
+
+// Samples are decoded or synthesized before the device starts, so playing
+// one later is a queue push. Without an audio device the game stays silent.
+void initAudio(AudioMixer* mixer) {
+    if (options.mute || SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        return;
+    }
+    for (int i = 0; i < SOUND_COUNT; i++) {
+        char path[256];
+        SDL_snprintf(path, sizeof(path), "./assets/sounds/%s.wav", soundNames[i]);
+        if (!loadSoundFile(&mixer->samples[i], path)) {
+            synthesizeSound(&mixer->samples[i], &soundRecipes[i]);
+        }
+    }
+    SDL_AudioSpec desired = { 0 };
+    desired.freq = AUDIO_FREQUENCY;
+    desired.format = AUDIO_F32SYS;
+    desired.channels = 2;
+    desired.samples = AUDIO_BUFFER_FRAMES;
+    desired.callback = mixAudio;
+    desired.userdata = mixer;
+    // SDL converts to whatever the hardware wants, so the callback always mixes this format
+    mixer->device = SDL_OpenAudioDevice(NULL, 0, &desired, &mixer->spec, 0);
+    if (!mixer->device) {
+        fprintf(stderr, "No audio: %s\n", SDL_GetError());
+        return;
+    }
+    if (options.showStats) {
+        printf("audio: %d Hz, %d frames per callback (%.1f ms)\n", mixer->spec.freq, mixer->spec.samples,
+            mixer->spec.samples * 1000.0 / mixer->spec.freq);
+    }
+    SDL_PauseAudioDevice(mixer->device, 0);
+}
+
+void shutdownAudio(AudioMixer* mixer) {
+    if (mixer->device) {
+        SDL_CloseAudioDevice(mixer->device);
+        if (options.showStats) {
+            printf("audio: %d voices stolen, %d sounds dropped\n", SDL_AtomicGet(&mixer->steals),
+                SDL_AtomicGet(&mixer->dropped));
+        }
+    }
+    for (int i = 0; i < SOUND_COUNT; i++) {
+        SDL_free(mixer->samples[i].samples);
+    }
+    *mixer = (AudioMixer){ 0 };
+}
+
+typedef struct {
+    const EnemyPool* enemies;
+    const SpatialGrid* grid;
+    float deltaTime;
+} BulletQuery;
+
+// Earliest enemy that bullet i hits along the path it covers this tick,
+// among the candidates or among every enemy when candidates is NULL, or -1.
+int earliestBulletHit(const BulletQuery* query, int i, const int* candidates, int count) {
+    const EnemyPool* enemies = query->enemies;
+    float reach = (float)(BULLET_SIZE / 2 + ENEMY_SIZE / 2);
+    float x = bullets.x[i], y = bullets.y[i];
+    float dx = bullets.vx[i] * query->deltaTime, dy = bullets.vy[i] * query->deltaTime;
+    int hit = -1;
+    float hitTime = 2;
+    for (int k = 0; k < count; k++) {
+        int j = candidates ? candidates[k] : k;
+        if (!enemies->alive[j]) continue;
+        float t = sweepPointCircle(x, y, dx, dy,
+            enemies->x[j] + ENEMY_SIZE / 2, enemies->y[j] + ENEMY_SIZE / 2, reach);
+        if (t >= 0 && t < hitTime) {
+            hit = j;
+            hitTime = t;
+        }
+    }
+    return hit;
+}
+
+// Sweeps bullet i along the path it covers this tick, so fast bullets and
+// long ticks can't skip over an enemy. Returns the earliest enemy hit along
+// the path, or -1. Only reads shared state, so bullets can be tested in parallel.
+int firstBulletHit(const BulletQuery* query, int i, int* results) {
+    float half = BULLET_SIZE / 2;
+    float x = bullets.x[i], y = bullets.y[i];
+    float dx = bullets.vx[i] * query->deltaTime, dy = bullets.vy[i] * query->deltaTime;
+    float minX = (dx < 0 ? x + dx : x) - half, maxX = (dx < 0 ? x : x + dx) + half;
+    float minY = (dy < 0 ? y + dy : y) - half, maxY = (dy < 0 ? y : y + dy) + half;
+    int found = gridQuery(query->grid, minX, minY, maxX, maxY, results);
+    return earliestBulletHit(query, i, results, found);
+}
+
+void findBulletHits(void* data, int begin, int end, int worker) {
+    for (int i = begin; i < end; i++) {
+        bullets.hit[i] = firstBulletHit(data, i, jobs.scratch[worker]);
+    }
+}
+
+// Bullets are tested against the enemies alive at the start of the pass in
+// parallel, then resolved one by one in bullet order like a plain loop
+// would. A precomputed target that is still alive is also the earliest hit
+// among the enemies left, so only bullets whose target an earlier bullet
+// already killed are tested again. Kills and score come out identical
+// however many threads ran.
+void checkBulletCollisions(EnemyPool* enemies, const SpatialGrid* grid, float deltaTime) {
+    BulletQuery query = { enemies, grid, deltaTime };
+    reserveJobScratch(grid->itemCapacity);
+    parallelFor(findBulletHits, &query, bullets.count, BULLET_JOB_GRAIN);
+
+    int i = 0;
+    while (i < bullets.count) {
+        int hit = bullets.hit[i];
+        if (hit >= 0 && !enemies->alive[hit]) {
+            hit = firstBulletHit(&query, i, grid->results);
+        }
+        if (hit >= 0) {
+            enemies->alive[hit] = false;
+            score++;
+            ENEMY_SPEED += 1.5;
+            removeBullet(&bullets, i);  // bullet i is now the former last one, check it too
+        } else {
+            i++;
+        }
+    }
+}
+
+int calculateNumBullets() {
+    if (score < 60) return 1;
     if (score < 100) return 2;
     return 3; // Cap at 3 bullets
 }
 
-void init() {
-    SDL_Init(SDL_INIT_VIDEO);
-    TTF_Init();
-    window = SDL_CreateWindow("Chase of The Lost",
-        SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_RESIZABLE);
-    
-    if (!window) {
-        SDL_Quit();
-        return;
+bool buildGlyphAtlas(GlyphAtlas* atlas, TTF_Font* font) {
+    SDL_Surface* glyphSurfaces[GLYPH_COUNT] = { 0 };
+    SDL_Color white = { 255, 255, 255, 255 };
+    int penX = 0, penY = 0, rowHeight = 0, atlasWidth = 0;
+
+    // measure and place every glyph, wrapping rows at the max atlas width
+    for (int i = 0; i < GLYPH_COUNT; i++) {
+        Uint16 ch = (Uint16)(GLYPH_FIRST + i);
+        Glyph* glyph = &atlas->glyphs[i];
+        glyphSurfaces[i] = TTF_RenderGlyph_Solid(font, ch, white);
+        if (TTF_GlyphMetrics(font, ch, NULL, NULL, NULL, NULL, &glyph->advance) != 0) {
+            glyph->advance = 0;
+        }
+        if (!glyphSurfaces[i]) {
+            glyph->src = (SDL_Rect){ 0, 0, 0, 0 };
+            continue;
+        }
+        if (penX + glyphSurfaces[i]->w > GLYPH_ATLAS_MAX_WIDTH) {
+            penX = 0;
+            penY += rowHeight + 1;
+            rowHeight = 0;
+        }
+        glyph->src = (SDL_Rect){ penX, penY, glyphSurfaces[i]->w, glyphSurfaces[i]->h };
+        penX += glyphSurfaces[i]->w + 1;
+        if (penX > atlasWidth) atlasWidth = penX;
+        if (glyphSurfaces[i]->h > rowHeight) rowHeight = glyphSurfaces[i]->h;
+    }
+
+    atlas->width = atlasWidth;
+    atlas->height = penY + rowHeight;
+    atlas->lineHeight = TTF_FontHeight(font);
+    atlas->texture = NULL;
+
+    SDL_Surface* atlasSurface = NULL;
+    if (atlas->width > 0 && atlas->height > 0) {
+        atlasSurface = SDL_CreateRGBSurfaceWithFormat(0, atlas->width, atlas->height, 32, SDL_PIXELFORMAT_ARGB8888);
+    }
+    if (atlasSurface) {
+        SDL_FillRect(atlasSurface, NULL, SDL_MapRGBA(atlasSurface->format, 0, 0, 0, 0));
+        for (int i = 0; i < GLYPH_COUNT; i++) {
+            if (glyphSurfaces[i]) {
+                SDL_Rect dst = atlas->glyphs[i].src;
+                SDL_BlitSurface(glyphSurfaces[i], NULL, atlasSurface, &dst);
+            }
+        }
+        atlas->texture = SDL_CreateTextureFromSurface(renderer, atlasSurface);
+        SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+        SDL_FreeSurface(atlasSurface);
+    }
+
+    for (int i = 0; i < GLYPH_COUNT; i++) {
+        SDL_FreeSurface(glyphSurfaces[i]);
+    }
+    return atlas->texture != NULL;
+}
+
+void destroyGlyphAtlas(GlyphAtlas* atlas) {
+    SDL_DestroyTexture(atlas->texture);
+    atlas->texture = NULL;
+}
+
+void initQuadIndices() {
+    for (int i = 0; i < MAX_LABEL_LENGTH; i++) {
+        quadIndices[i * 6 + 0] = i * 4 + 0;
+        quadIndices[i * 6 + 1] = i * 4 + 1;
+        quadIndices[i * 6 + 2] = i * 4 + 2;
+        quadIndices[i * 6 + 3] = i * 4 + 2;
+        quadIndices[i * 6 + 4] = i * 4 + 1;
+        quadIndices[i * 6 + 5] = i * 4 + 3;
+    }
+}
+
+void rebuildLabel(TextLabel* label) {
+    GlyphAtlas* atlas = label->atlas;
+    float penX = (float)label->x;
+    float top = (float)label->y;
+    label->glyphCount = 0;
+
+    for (const char* c = label->text; *c; c++) {
+        int index = (unsigned char)*c - GLYPH_FIRST;
+        if (index < 0 || index >= GLYPH_COUNT) {
+            index = '?' - GLYPH_FIRST;
+        }
+        Glyph* glyph = &atlas->glyphs[index];
+        if (glyph->src.w > 0 && glyph->src.h > 0) {
+            float u0 = (float)glyph->src.x / atlas->width;
+            float v0 = (float)glyph->src.y / atlas->height;
+            float u1 = (float)(glyph->src.x + glyph->src.w) / atlas->width;
+            float v1 = (float)(glyph->src.y + glyph->src.h) / atlas->height;
+            float right = penX + glyph->src.w;
+            float bottom = top + glyph->src.h;
+            SDL_Vertex* v = &label->vertices[label->glyphCount * 4];
+            v[0] = (SDL_Vertex){ { penX, top }, label->color, { u0, v0 } };
+            v[1] = (SDL_Vertex){ { right, top }, label->color, { u1, v0 } };
+            v[2] = (SDL_Vertex){ { penX, bottom }, label->color, { u0, v1 } };
+            v[3] = (SDL_Vertex){ { right, bottom }, label->color, { u1, v1 } };
+            label->glyphCount++;
+        }
+        penX += glyph->advance;
+    }
+
+    label->w = (int)penX - label->x;
+    label->h = atlas->lineHeight;
+}
+
+int measureText(GlyphAtlas* atlas, const char* text) {
+    int width = 0;
+    for (const char* c = text; *c; c++) {
+        int index = (unsigned char)*c - GLYPH_FIRST;
+        if (index < 0 || index >= GLYPH_COUNT) {
+            index = '?' - GLYPH_FIRST;
+        }
+        width += atlas->glyphs[index].advance;
+    }
+    return width;
+}
+
+void setLabelText(TextLabel* label, const char* text) {
+    if (strncmp(label->text, text, MAX_LABEL_LENGTH - 1) == 0 && label->text[0] != '\0') {
+        return;
+    }
+    SDL_strlcpy(label->text, text, MAX_LABEL_LENGTH);
+    label->hasValue = false;
+    rebuildLabel(label);
+}
+
+// Only formats and rebuilds the label when the number actually changed.
+void setLabelValue(TextLabel* label, const char* format, int value) {
+    if (label->hasValue && label->value == value) {
+        return;
+    }
+    char text[MAX_LABEL_LENGTH];
+    SDL_snprintf(text, sizeof(text), format, value);
+    setLabelText(label, text);
+    label->value = value;
+    label->hasValue = true;
+}
+
+void setLabelPosition(TextLabel* label, int x, int y) {
+    if (label->x == x && label->y == y) {
+        return;
+    }
+    float dx = (float)(x - label->x);
+    float dy = (float)(y - label->y);
+    for (int i = 0; i < label->glyphCount * 4; i++) {
+        label->vertices[i].position.x += dx;
+        label->vertices[i].position.y += dy;
+    }
+    label->x = x;
+    label->y = y;
+}
+
+void renderLabel(TextLabel* label) {
+    if (label->glyphCount == 0 || !label->atlas->texture) {
+        return;
+    }
+    drawGeometry(label->atlas->texture, label->vertices, label->glyphCount * 4,
+        quadIndices, label->glyphCount * 6);
+}
+
+Uint32 crc32(const Uint8* data, size_t length) {
+    Uint32 crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+}
+
+void writeU32(Uint8* out, Uint32 value) {
+    for (int i = 0; i < 4; i++) out[i] = (Uint8)(value >> (8 * i));
+}
+
+void writeU64(Uint8* out, Uint64 value) {
+    for (int i = 0; i < 8; i++) out[i] = (Uint8)(value >> (8 * i));
+}
+
+Uint32 readU32(const Uint8* in) {
+    Uint32 value = 0;
+    for (int i = 0; i < 4; i++) value |= (Uint32)in[i] << (8 * i);
+    return value;
+}
+
+Uint64 readU64(const Uint8* in) {
+    Uint64 value = 0;
+    for (int i = 0; i < 8; i++) value |= (Uint64)in[i] << (8 * i);
+    return value;
+}
+
+// Layout: magic, version, count, count * (score, timestamp), crc32 of everything before it.
+// All fields little-endian.
+size_t encodeScoreFile(Uint8* out, const ScoreEntry entries[], int count) {
+    Uint8* p = out;
+    writeU32(p, SCORE_FILE_MAGIC); p += 4;
+    writeU32(p, SCORE_FILE_VERSION); p += 4;
+    writeU32(p, (Uint32)count); p += 4;
+    for (int i = 0; i < count; i++) {
+        writeU32(p, (Uint32)entries[i].score); p += 4;
+        writeU64(p, (Uint64)entries[i].timestamp); p += 8;
+    }
+    writeU32(p, crc32(out, (size_t)(p - out))); p += 4;
+    return (size_t)(p - out);
+}
+
+int decodeScoreFile(const Uint8* in, size_t size, ScoreEntry entries[]) {
+    // highscore.dat from older versions is a single raw int
+    if (size == sizeof(int)) {
+        int legacyScore;
+        memcpy(&legacyScore, in, sizeof(int));
+        if (legacyScore <= 0) return 0;
+        entries[0] = (ScoreEntry){ legacyScore, 0 };
+        return 1;
+    }
+
+    if (size < SCORE_FILE_HEADER_SIZE + 4 ||
+        readU32(in) != SCORE_FILE_MAGIC ||
+        readU32(in + 4) != SCORE_FILE_VERSION) {
+        return 0;
+    }
+    Uint32 count = readU32(in + 8);
+    if (count > LEADERBOARD_SIZE || size != SCORE_FILE_HEADER_SIZE + count * SCORE_ENTRY_SIZE + 4) {
+        return 0;
+    }
+    size_t payload = size - 4;
+    if (readU32(in + payload) != crc32(in, payload)) {
+        return 0;
+    }
+    for (Uint32 i = 0; i < count; i++) {
+        const Uint8* p = in + SCORE_FILE_HEADER_SIZE + i * SCORE_ENTRY_SIZE;
+        entries[i].score = (Sint32)readU32(p);
+        entries[i].timestamp = (Sint64)readU64(p + 4);
+    }
+    return (int)count;
+}
+
+bool replaceFile(const char* from, const char* to) {
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+// Writes to a temp file and renames it over the real one, so a crash
+// mid-write leaves the previous leaderboard intact.
+bool writeScoreFile(const ScoreEntry entries[], int count) {
+    Uint8 buffer[SCORE_FILE_MAX_SIZE];
+    size_t size = encodeScoreFile(buffer, entries, count);
+
+    FILE* file = fopen(SCORE_FILE_TEMP, "wb");
+    if (!file) {
+        return false;
+    }
+    bool written = fwrite(buffer, 1, size, file) == size && fflush(file) == 0;
+#ifdef _WIN32
+    written = written && _commit(_fileno(file)) == 0;
+#else
+    written = written && fsync(fileno(file)) == 0;
+#endif
+    fclose(file);
+
+    if (!written || !replaceFile(SCORE_FILE_TEMP, SCORE_FILE)) {
+        remove(SCORE_FILE_TEMP);
+        return false;
+    }
+    return true;
+}
+
+int scoreWriterThread(void* data) {
+    ScoreStore* store = data;
+    ScoreEntry entries[LEADERBOARD_SIZE];
+
+    SDL_LockMutex(store->lock);
+    for (;;) {
+        while (store->revision == store->savedRevision && !store->shuttingDown) {
+            SDL_CondWait(store->changed, store->lock);
+        }
+        if (store->revision == store->savedRevision) {
+            break;
+        }
+        Uint32 revision = store->revision;
+        int count = store->count;
+        memcpy(entries, store->entries, sizeof(entries));
+        SDL_UnlockMutex(store->lock);
+
+        if (!writeScoreFile(entries, count)) {
+            SDL_Log("Could not save %s", SCORE_FILE);
+        }
+
+        SDL_LockMutex(store->lock);
+        store->savedRevision = revision;
+    }
+    SDL_UnlockMutex(store->lock);
+    return 0;
+}
+
+void initScoreStore() {
+    FILE* file = fopen(SCORE_FILE, "rb");
+    if (file) {
+        Uint8 buffer[SCORE_FILE_MAX_SIZE + 1];
+        size_t size = fread(buffer, 1, sizeof(buffer), file);
+        fclose(file);
+        scoreStore.count = decodeScoreFile(buffer, size, scoreStore.entries);
+    }
+
+    scoreStore.lock = SDL_CreateMutex();
+    scoreStore.changed = SDL_CreateCond();
+    scoreStore.writer = SDL_CreateThread(scoreWriterThread, "ScoreWriter", &scoreStore);
+}
+
+int getHighScore() {
+    return scoreStore.count > 0 ? scoreStore.entries[0].score : 0;
+}
+
+// Inserts the score into the leaderboard and queues a save when it placed.
+void submitScore(int score) {
+    if (score <= 0) {
+        return;
+    }
+
+    SDL_LockMutex(scoreStore.lock);
+    int slot = scoreStore.count;
+    while (slot > 0 && scoreStore.entries[slot - 1].score < score) {
+        slot--;
+    }
+    if (slot < LEADERBOARD_SIZE) {
+        int last = scoreStore.count < LEADERBOARD_SIZE ? scoreStore.count : LEADERBOARD_SIZE - 1;
+        memmove(&scoreStore.entries[slot + 1], &scoreStore.entries[slot],
+            (last - slot) * sizeof(ScoreEntry));
+        scoreStore.entries[slot] = (ScoreEntry){ score, (Sint64)time(NULL) };
+        if (scoreStore.count < LEADERBOARD_SIZE) scoreStore.count++;
+        scoreStore.revision++;
+        SDL_CondSignal(scoreStore.changed);
+    }
+    SDL_UnlockMutex(scoreStore.lock);
+}
+
+// Flushes any pending save and stops the writer thread.
+void shutdownScoreStore() {
+    if (!scoreStore.writer) {
+        // no writer thread, save synchronously instead
+        if (scoreStore.revision != scoreStore.savedRevision) {
+            writeScoreFile(scoreStore.entries, scoreStore.count);
+        }
+    } else {
+        SDL_LockMutex(scoreStore.lock);
+        scoreStore.shuttingDown = true;
+        SDL_CondSignal(scoreStore.changed);
+        SDL_UnlockMutex(scoreStore.lock);
+        SDL_WaitThread(scoreStore.writer, NULL);
+        scoreStore.writer = NULL;
+    }
+    SDL_DestroyCond(scoreStore.changed);
+    SDL_DestroyMutex(scoreStore.lock);
+}
+
+// Decodes one LZ4 block. Every read and write is bounds-checked, so a
+// damaged bundle fails to load instead of corrupting memory.
+int lz4Decompress(const Uint8* src, size_t srcSize, Uint8* dst, size_t dstSize) {
+    const Uint8* in = src;
+    const Uint8* inEnd = src + srcSize;
+    Uint8* out = dst;
+    Uint8* outEnd = dst + dstSize;
+
+    while (in < inEnd) {
+        Uint8 token = *in++;
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            Uint8 extra;
+            do {
+                if (in >= inEnd) return -1;
+                extra = *in++;
+                literals += extra;
+            } while (extra == 255);
+        }
+        if (literals > (size_t)(inEnd - in) || literals > (size_t)(outEnd - out)) return -1;
+        memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+        if (in == inEnd) break;  // the last sequence has no match
+
+        if (inEnd - in < 2) return -1;
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (size_t)(out - dst)) return -1;
+        size_t length = token & 15;
+        if (length == 15) {
+            Uint8 extra;
+            do {
+                if (in >= inEnd) return -1;
+                extra = *in++;
+                length += extra;
+            } while (extra == 255);
+        }
+        length += LZ4_MIN_MATCH;
+        if (length > (size_t)(outEnd - out)) return -1;
+
+        const Uint8* match = out - offset;
+        if (offset >= length) {
+            memcpy(out, match, length);
+            out += length;
+        } else {
+            while (length--) *out++ = *match++;  // overlapping run
+        }
+    }
+    return (int)(out - dst);
+}
+
+void closeBundle(AssetBundle* bundle) {
+    if (bundle->data) {
+#ifdef _WIN32
+        UnmapViewOfFile(bundle->data);
+#else
+        munmap((void*)bundle->data, bundle->size);
+#endif
+    }
+    memset(bundle, 0, sizeof(*bundle));
+}
+
+bool openBundle(AssetBundle* bundle, const char* path) {
+    memset(bundle, 0, sizeof(*bundle));
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = GetFileSizeEx(file, &size) ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+    CloseHandle(file);  // the mapping keeps the file open
+    if (!mapping) {
+        return false;
+    }
+    bundle->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);  // and the view keeps the mapping alive
+    bundle->size = (size_t)size.QuadPart;
+#else
+    int file = open(path, O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+    struct stat info;
+    void* data = MAP_FAILED;
+    if (fstat(file, &info) == 0 && info.st_size > 0) {
+        data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    close(file);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    bundle->data = data;
+    bundle->size = (size_t)info.st_size;
+#endif
+    if (!bundle->data) {
+        return false;
+    }
+
+    const Uint8* in = bundle->data;
+    Uint32 count = bundle->size >= BUNDLE_HEADER_SIZE ? readU32(in + 8) : 0;
+    if (bundle->size < BUNDLE_HEADER_SIZE ||
+        readU32(in) != BUNDLE_MAGIC ||
+        readU32(in + 4) != BUNDLE_VERSION ||
+        count > BUNDLE_MAX_ENTRIES ||
+        bundle->size < BUNDLE_HEADER_SIZE + count * BUNDLE_ENTRY_SIZE) {
+        SDL_Log("%s is not a valid asset bundle", path);
+        closeBundle(bundle);
+        return false;
+    }
+    for (Uint32 i = 0; i < count; i++) {
+        const Uint8* p = in + BUNDLE_HEADER_SIZE + i * BUNDLE_ENTRY_SIZE;
+        BundleEntry* entry = &bundle->entries[i];
+        memcpy(entry->name, p, BUNDLE_NAME_LENGTH);
+        entry->name[BUNDLE_NAME_LENGTH - 1] = '\0';
+        entry->width = readU32(p + 32);
+        entry->height = readU32(p + 36);
+        entry->compression = readU32(p + 40);
+        entry->offset = readU64(p + 48);
+        entry->storedSize = readU64(p + 56);
+        entry->rawSize = readU64(p + 64);
+        if (entry->offset > bundle->size || entry->storedSize > bundle->size - entry->offset ||
+            (entry->compression == BUNDLE_RAW && entry->storedSize != entry->rawSize)) {
+            SDL_Log("%s: entry %s is out of range", path, entry->name);
+            closeBundle(bundle);
+            return false;
+        }
+    }
+    bundle->entryCount = (int)count;
+    return true;
+}
+
+const BundleEntry* findBundleEntry(const AssetBundle* bundle, const char* name) {
+    for (int i = 0; i < bundle->entryCount; i++) {
+        if (strcmp(bundle->entries[i].name, name) == 0) {
+            return &bundle->entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Raw images are wrapped in place, so their pixels are read straight from
+// the mapped file; compressed ones are inflated into a new surface.
+SDL_Surface* bundleImage(const AssetBundle* bundle, const BundleEntry* entry) {
+    int width = (int)entry->width, height = (int)entry->height;
+    if ((Uint64)width * height * 4 != entry->rawSize) {
+        return NULL;
+    }
+    const Uint8* stored = bundle->data + entry->offset;
+    if (entry->compression == BUNDLE_RAW) {
+        return SDL_CreateRGBSurfaceWithFormatFrom((void*)stored, width, height, 32, width * 4, SDL_PIXELFORMAT_RGBA32);
+    }
+
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGBA32);
+    if (!surface) {
+        return NULL;
+    }
+    // packed rows, since the packer stores width * 4 bytes per row
+    if (surface->pitch != width * 4 ||
+        lz4Decompress(stored, entry->storedSize, surface->pixels, entry->rawSize) != (int)entry->rawSize) {
+        SDL_Log("Could not decode %s from the asset bundle", entry->name);
+        SDL_FreeSurface(surface);
+        return NULL;
+    }
+    return surface;
+}
+
+SDL_Surface* loadAssetSurface(int asset) {
+    if (assets.hasBundle) {
+        const BundleEntry* entry = findBundleEntry(&assets.bundle, assetNames[asset]);
+        if (entry) {
+            return bundleImage(&assets.bundle, entry);
+        }
+    }
+    char path[128];
+    SDL_snprintf(path, sizeof(path), "./assets/images/%s.png", assetNames[asset]);
+    SDL_Surface* surface = IMG_Load(path);
+    if (!surface) {
+        SDL_Log("Could not load %s: %s", path, SDL_GetError());
+        return NULL;
+    }
+    SDL_Point size = assetPackSizes[asset];
+    if (size.x > 0 && (surface->w != size.x || surface->h != size.y)) {
+        SDL_Surface* scaled = resampleImage(surface, size.x, size.y);
+        if (scaled) {
+            SDL_FreeSurface(surface);
+            surface = scaled;
+        }
+    }
+    return surface;
+}
+
+int assetLoaderThread(void* data) {
+    (void)data;
+    for (int i = 0; i < ASSET_COUNT; i++) {
+        if (SDL_AtomicGet(&assets.ready[i])) {
+            continue;
+        }
+        assets.surfaces[i] = loadAssetSurface(i);
+        SDL_AtomicSet(&assets.ready[i], 1);
+        SDL_Event wake = { .type = assets.wakeEvent };
+        SDL_PushEvent(&wake);
+    }
+    return 0;
+}
+
+// Turns decoded surfaces into textures. The renderer only accepts uploads
+// from the main thread, so the loader thread decodes and this uploads.
+// Returns true once every asset is on the GPU.
+bool pumpAssetUploads() {
+    for (int i = ASSET_MENU_BACKGROUND; i <= ASSET_BACKGROUND; i++) {
+        if (!assets.uploaded[i] && SDL_AtomicGet(&assets.ready[i])) {
+            // shown at full size until the texture cache has scaled it
+            CachedTexture* entry = &textureCache.entries[i];
+            *entry->texture = assets.surfaces[i] ? SDL_CreateTextureFromSurface(renderer, assets.surfaces[i]) : NULL;
+            entry->source = assets.surfaces[i];
+            assets.surfaces[i] = NULL;
+            assets.uploaded[i] = true;
+        }
+    }
+
+    if (!assets.uploaded[ASSET_PLAYER] && SDL_AtomicGet(&assets.ready[ASSET_PLAYER]) &&
+        SDL_AtomicGet(&assets.ready[ASSET_ENEMY]) && SDL_AtomicGet(&assets.ready[ASSET_FIREBALL])) {
+        SDL_Surface* images[SPRITE_COUNT] = { 0 };
+        images[SPRITE_PLAYER] = assets.surfaces[ASSET_PLAYER];
+        images[SPRITE_ENEMY] = assets.surfaces[ASSET_ENEMY];
+        images[SPRITE_FIREBALL] = assets.surfaces[ASSET_FIREBALL];
+        buildSpriteAtlas(&spriteAtlas, images);
+        for (int i = ASSET_PLAYER; i <= ASSET_FIREBALL; i++) {
+            SDL_FreeSurface(assets.surfaces[i]);
+            assets.surfaces[i] = NULL;
+            assets.uploaded[i] = true;
+        }
+    }
+
+    for (int i = 0; i < ASSET_COUNT; i++) {
+        if (!assets.uploaded[i]) return false;
+    }
+    return true;
+}
+
+TTF_Font* openAssetFont(int size) {
+    if (!assets.fontData) {
+        return NULL;
+    }
+    return TTF_OpenFontRW(SDL_RWFromConstMem(assets.fontData, (int)assets.fontSize), 1, size);
+}
+
+// Maps the bundle, or falls back to the loose files under assets/ when it
+// is missing. Only the font and the menu background are loaded before
+// returning; the rest is decoded by a background thread while the menu runs.
+void startAssetLoading() {
+    assets.hasBundle = openBundle(&assets.bundle, BUNDLE_FILE);
+    assets.wakeEvent = SDL_RegisterEvents(1);
+
+    const BundleEntry* fontEntry = assets.hasBundle ? findBundleEntry(&assets.bundle, BUNDLE_FONT_NAME) : NULL;
+    if (fontEntry && fontEntry->compression == BUNDLE_RAW) {
+        assets.fontData = assets.bundle.data + fontEntry->offset;
+        assets.fontSize = (size_t)fontEntry->storedSize;
+    } else {
+        // read once and shared by both sizes
+        assets.fontData = SDL_LoadFile("./assets/fonts/VCR_OSD_MONO.ttf", &assets.fontSize);
+        assets.ownsFontData = true;
+    }
+
+    assets.surfaces[ASSET_MENU_BACKGROUND] = loadAssetSurface(ASSET_MENU_BACKGROUND);
+    SDL_AtomicSet(&assets.ready[ASSET_MENU_BACKGROUND], 1);
+    pumpAssetUploads();
+
+    assets.loader = SDL_CreateThread(assetLoaderThread, "assets", NULL);
+    if (!assets.loader) {
+        assetLoaderThread(NULL);
+    }
+}
+
+// Blocks until the loader thread is done and everything is uploaded.
+void finishAssetLoading() {
+    if (assets.loader) {
+        SDL_WaitThread(assets.loader, NULL);
+        assets.loader = NULL;
+    }
+    pumpAssetUploads();
+}
+
+int textureCacheWorker(void* data) {
+    (void)data;
+    for (int i = 0; i < CACHED_TEXTURE_COUNT; i++) {
+        SDL_Surface* source = textureCache.jobSources[i];
+        SDL_Point size = textureCache.jobSizes[i];
+        textureCache.results[i] = source ? resampleImage(source, size.x, size.y) : NULL;
+    }
+    SDL_AtomicSet(&textureCache.done, 1);
+    SDL_Event wake = { .type = assets.wakeEvent };
+    SDL_PushEvent(&wake);
+    return 0;
+}
+
+// Keeps each background as a texture of exactly the size it is drawn at, so
+// it is copied without any resampling. When that size changes the old
+// texture stays on screen, stretched, until a worker has made the new one.
+// Returns true when a texture was replaced and the screen needs a redraw.
+bool pumpTextureCache() {
+    bool replaced = false;
+    if (textureCache.worker) {
+        if (!SDL_AtomicGet(&textureCache.done)) {
+            return false;
+        }
+        SDL_WaitThread(textureCache.worker, NULL);
+        textureCache.worker = NULL;
+        allocCheckWarmup();
+        for (int i = 0; i < CACHED_TEXTURE_COUNT; i++) {
+            CachedTexture* entry = &textureCache.entries[i];
+            SDL_Texture* texture = textureCache.results[i] ? SDL_CreateTextureFromSurface(renderer, textureCache.results[i]) : NULL;
+            if (texture) {
+                SDL_DestroyTexture(*entry->texture);
+                *entry->texture = texture;
+                entry->scaledFrom = textureCache.jobSources[i];
+                entry->width = textureCache.jobSizes[i].x;
+                entry->height = textureCache.jobSizes[i].y;
+                replaced = true;
+            }
+            if (i == ASSET_BACKGROUND) {
+                setDirtyBackground(&dirtyRenderer, textureCache.results[i]);
+            }
+            SDL_FreeSurface(textureCache.results[i]);
+            textureCache.results[i] = NULL;
+        }
+    }
+
+    updateSceneLayout();
+    SDL_Point sizes[CACHED_TEXTURE_COUNT];
+    sizes[ASSET_MENU_BACKGROUND] = (SDL_Point){ scene.outputWidth, scene.outputHeight };
+    sizes[ASSET_BACKGROUND] = (SDL_Point){ scene.view.w, scene.view.h };
+    bool stale = false;
+    for (int i = 0; i < CACHED_TEXTURE_COUNT; i++) {
+        const CachedTexture* entry = &textureCache.entries[i];
+        stale = stale || (entry->source && sizes[i].x > 0 && sizes[i].y > 0 && (entry->scaledFrom != entry->source ||
+            entry->width != sizes[i].x || entry->height != sizes[i].y));
+    }
+    if (stale) {
+        for (int i = 0; i < CACHED_TEXTURE_COUNT; i++) {
+            textureCache.jobSources[i] = textureCache.entries[i].source;
+            textureCache.jobSizes[i] = sizes[i];
+        }
+        SDL_AtomicSet(&textureCache.done, 0);
+        allocCheckWarmup();
+        textureCache.worker = SDL_CreateThread(textureCacheWorker, "texture cache", NULL);
+    }
+    return replaced;
+}
+
+void shutdownTextureCache() {
+    if (textureCache.worker) {
+        SDL_WaitThread(textureCache.worker, NULL);
+        textureCache.worker = NULL;
+    }
+    for (int i = 0; i < CACHED_TEXTURE_COUNT; i++) {
+        SDL_FreeSurface(textureCache.results[i]);
+        SDL_FreeSurface(textureCache.entries[i].source);
+        textureCache.results[i] = NULL;
+        textureCache.entries[i].source = NULL;
+    }
+}
+
+void shutdownAssets() {
+    finishAssetLoading();
+    if (assets.ownsFontData) {
+        SDL_free((void*)assets.fontData);
+    }
+    assets.fontData = NULL;
+    closeBundle(&assets.bundle);
+    assets.hasBundle = false;
+}
+
+Uint64 profileNow() {
+    return profiler.enabled ? SDL_GetPerformanceCounter() : 0;
+}
+
+// Appends one finished zone to the ring. Any thread may call this: the slot
+// is claimed with an atomic increment, so writers never block each other.
+void profileRecord(int zone, Uint64 start) {
+    if (!profiler.enabled) {
+        return;
+    }
+    Uint64 end = SDL_GetPerformanceCounter();
+    SDL_threadID thread = SDL_ThreadID();
+    int slot = SDL_AtomicAdd(&profiler.writeIndex, 1) & (PROFILE_RING_SIZE - 1);
+    profiler.events[slot] = (ProfileEvent){ start, end, profiler.frame, (Uint32)thread, (Uint16)zone };
+    if (thread == profiler.mainThread || thread == profiler.simThread) {
+        profiler.zoneTotal[zone] += end - start;
+    }
+}
+
+void initProfiler(bool enabled) {
+#if COTL_PROFILE
+    profiler.enabled = enabled;
+#else
+    (void)enabled;
+#endif
+    if (profiler.enabled) {
+        profiler.events = SDL_calloc(PROFILE_RING_SIZE, sizeof(ProfileEvent));
+        profiler.enabled = profiler.events != NULL;
+    }
+    profiler.mainThread = SDL_ThreadID();
+    for (int i = 0; i <= ZONE_COUNT; i++) {
+        profiler.labels[i] = (TextLabel){ .atlas = &fontAtlas, .color = { 255, 255, 255, 255 } };
+    }
+}
+
+// Folds this frame's zone totals into the smoothed overlay figures.
+void profileFrameEnd(double frameMs) {
+    if (!profiler.enabled) {
+        return;
+    }
+    double toMs = 1000.0 / SDL_GetPerformanceFrequency();
+    for (int i = 0; i < ZONE_COUNT; i++) {
+        float ms = (float)(profiler.zoneTotal[i] * toMs);
+        profiler.zoneMs[i] += (ms - profiler.zoneMs[i]) * 0.1f;
+        profiler.zoneTotal[i] = 0;
+    }
+    profiler.frameHistory[profiler.historyIndex] = (float)frameMs;
+    profiler.historyIndex = (profiler.historyIndex + 1) % PROFILE_HISTORY;
+    profiler.frame++;
+}
+
+void renderProfilerOverlay(const WorldSnapshot* snapshot) {
+    if (!profiler.overlayVisible || !profiler.enabled) {
+        return;
+    }
+    int lineHeight = fontAtlas.lineHeight;
+    SDL_Rect panel = { SCREEN_WIDTH - 410, 10, 400, PROFILE_GRAPH_HEIGHT + (ZONE_COUNT + 1) * lineHeight + 30 };
+
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 180);
+    drawCallCount++;
+    SDL_RenderFillRect(renderer, &panel);
+
+    // frame time graph, full height is two 60 Hz frames
+    int graphBottom = panel.y + 10 + PROFILE_GRAPH_HEIGHT;
+    float pixelsPerMs = PROFILE_GRAPH_HEIGHT / 33.3f;
+    SDL_Point graph[PROFILE_HISTORY];
+    for (int i = 0; i < PROFILE_HISTORY; i++) {
+        float ms = profiler.frameHistory[(profiler.historyIndex + i) % PROFILE_HISTORY];
+        int height = (int)(ms * pixelsPerMs);
+        if (height > PROFILE_GRAPH_HEIGHT) height = PROFILE_GRAPH_HEIGHT;
+        graph[i] = (SDL_Point){ panel.x + 10 + i * (panel.w - 20) / PROFILE_HISTORY, graphBottom - height };
+    }
+    SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
+    int budget = graphBottom - (int)(16.7f * pixelsPerMs);
+    drawCallCount += 2;
+    SDL_RenderDrawLine(renderer, panel.x + 10, budget, panel.x + panel.w - 10, budget);
+    SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);
+    SDL_RenderDrawLines(renderer, graph, PROFILE_HISTORY);
+
+    // text is reformatted a few times a second so the labels stay cached in between
+    Uint32 now = SDL_GetTicks();
+    if (now - profiler.labelRefresh >= PROFILE_LABEL_REFRESH_MS) {
+        char text[MAX_LABEL_LENGTH];
+        for (int i = 0; i < ZONE_COUNT; i++) {
+            SDL_snprintf(text, sizeof(text), "%-10s%6.2f ms", zoneNames[i], profiler.zoneMs[i]);
+            setLabelText(&profiler.labels[i], text);
+        }
+        SDL_snprintf(text, sizeof(text), "E%d B%d D%d", snapshot->enemyCount, snapshot->bulletCount,
+            lastFrameDrawCalls);
+        setLabelText(&profiler.labels[ZONE_COUNT], text);
+        profiler.labelRefresh = now;
+    }
+    for (int i = 0; i <= ZONE_COUNT; i++) {
+        setLabelPosition(&profiler.labels[i], panel.x + 10, graphBottom + 10 + i * lineHeight);
+        renderLabel(&profiler.labels[i]);
+    }
+}
+
+// Writes the ring, oldest event first, as Chrome trace JSON
+// (chrome://tracing, Perfetto) or as CSV when the path ends in .csv.
+void exportProfile(const char* path) {
+    if (!profiler.enabled || !path) {
+        return;
+    }
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        SDL_Log("Could not write %s", path);
+        return;
+    }
+    int written = SDL_AtomicGet(&profiler.writeIndex);
+    int count = written < PROFILE_RING_SIZE ? written : PROFILE_RING_SIZE;
+    int first = written - count;
+    size_t length = strlen(path);
+    bool csv = length > 4 && strcmp(path + length - 4, ".csv") == 0;
+    double toUs = 1000000.0 / SDL_GetPerformanceFrequency();
+    Uint64 origin = count > 0 ? profiler.events[first & (PROFILE_RING_SIZE - 1)].start : 0;
+
+    fprintf(file, csv ? "zone,frame,thread,start_us,duration_us\n" : "{\"traceEvents\":[\n");
+    for (int i = 0; i < count; i++) {
+        const ProfileEvent* event = &profiler.events[(first + i) & (PROFILE_RING_SIZE - 1)];
+        double start = (double)(Sint64)(event->start - origin) * toUs;
+        double duration = (double)(event->end - event->start) * toUs;
+        if (csv) {
+            fprintf(file, "%s,%u,%u,%.3f,%.3f\n", zoneNames[event->zone], event->frame, event->thread, start, duration);
+        } else {
+            fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}%s\n",
+                zoneNames[event->zone], event->thread, start, duration, event->frame, i + 1 < count ? "," : "");
+        }
+    }
+    if (!csv) {
+        fprintf(file, "]}\n");
+    }
+    fclose(file);
+}
+
+void shutdownProfiler() {
+    exportProfile(options.tracePath);
+    SDL_free(profiler.events);
+    profiler.events = NULL;
+    profiler.enabled = false;
+}
+
+// What drawing needs once the window and renderer exist. The benchmark
+// runner sets up its hidden window through this as well.
+void initRendering() {
+    initDirtyRenderer(&dirtyRenderer);
+
+    startAssetLoading();
+    font = openAssetFont(24);
+    gameOverFont = openAssetFont(100);
+
+    initQuadIndices();
+    initFrameArena();
+    initParticles(&particles);
+    buildGlyphAtlas(&fontAtlas, font);
+    buildGlyphAtlas(&gameOverAtlas, gameOverFont);
+    scoreLabel = (TextLabel){ .atlas = &fontAtlas, .color = { 255, 255, 255, 255 }, .x = 10, .y = 20 };
+    highScoreLabel = (TextLabel){ .atlas = &fontAtlas, .color = { 255, 255, 255, 255 }, .x = 10, .y = 70 };
+    gameOverLabel = (TextLabel){ .atlas = &gameOverAtlas, .color = { 255, 0, 0, 255 } };
+    setLabelText(&gameOverLabel, "Game Over");
+}
+
+void shutdownRendering() {
+    finishAssetLoading();
+    SDL_DestroyTexture(backgroundTexture);
+    SDL_DestroyTexture(menuBackgroundTexture);
+    SDL_DestroyTexture(spriteAtlas.texture);
+    SDL_DestroyTexture(scene.target);
+    freeBatch(&spriteBatch);
+    freeDirtyRenderer(&dirtyRenderer);
+    freeParticles(&particles);
+    freeFrameArena();
+    destroyGlyphAtlas(&fontAtlas);
+    destroyGlyphAtlas(&gameOverAtlas);
+    TTF_CloseFont(font);
+    TTF_CloseFont(gameOverFont);
+    shutdownTextureCache();
+    shutdownAssets();
+}
+
+void init() {
+    launchCounter = SDL_GetPerformanceCounter();
+    SDL_Init(SDL_INIT_VIDEO);
+    TTF_Init();
+    window = SDL_CreateWindow("Chase of The Lost",
+        SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_RESIZABLE);
+    
+    if (!window) {
+        SDL_Quit();
+        return;
+    }
+
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED |
+        (options.vsync && options.fpsCap == 0 ? SDL_RENDERER_PRESENTVSYNC : 0));
+    //switch to software rendering
+    if (!renderer) {
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+    }
+    initRendering();
+    initAudio(&audio);
+    
+    initFramePacing();
+    initScene();
+    initProfiler(true);
+    initScoreStore();
+}
+
+void cleanup() {
+    shutdownProfiler();
+    shutdownScoreStore();
+    freeBullets(&bullets);
+    shutdownAudio(&audio);
+    shutdownRendering();
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    IMG_Quit();
+    TTF_Quit();
+    SDL_Quit();
+}
+
+void renderBackground() {
+    SDL_Rect world = { 0, 0, WORLD_WIDTH, WORLD_HEIGHT };
+    drawTexture(backgroundTexture, NULL, &world);
+}
+
+void renderHPBar(SpriteBatch* batch, const Entity* player) {
+    int barWidth = 200;  
+    int barHeight = 20;  
+
+    int x = (WORLD_WIDTH - barWidth) / 2; 
+    int y = WORLD_HEIGHT - barHeight - 10;
+
+    float hpPercentage = (float)player->hp / PLAYER_MAX_HP;
+    int currentBarWidth = (int)(barWidth * hpPercentage);
+
+    batchSprite(batch, SPRITE_WHITE, x, y, barWidth, barHeight, (SDL_Color){ 128, 128, 128, 255 });  // Gray 
+    batchSprite(batch, SPRITE_WHITE, x, y, currentBarWidth, barHeight, (SDL_Color){ 255, 0, 0, 255 });  // Red 
+}
+
+
+void reserveSnapshot(WorldSnapshot* snapshot, int enemyCount, int bulletCount) {
+    if (enemyCount > snapshot->enemyCapacity) {
+        snapshot->enemyX = SDL_realloc(snapshot->enemyX, enemyCount * sizeof(float));
+        snapshot->enemyY = SDL_realloc(snapshot->enemyY, enemyCount * sizeof(float));
+        snapshot->enemyCapacity = enemyCount;
+    }
+    if (bulletCount > snapshot->bulletCapacity) {
+        snapshot->bulletX = SDL_realloc(snapshot->bulletX, bulletCount * sizeof(float));
+        snapshot->bulletY = SDL_realloc(snapshot->bulletY, bulletCount * sizeof(float));
+        snapshot->bulletCapacity = bulletCount;
+    }
+}
+
+void captureSnapshot(WorldSnapshot* snapshot, const World* world) {
+    const EnemyPool* enemies = &world->enemies;
+    reserveSnapshot(snapshot, enemies->count, bullets.count);
+    snapshot->player = world->player;
+    snapshot->redDotX = world->redDotX;
+    snapshot->redDotY = world->redDotY;
+    snapshot->score = score;
+    snapshot->enemyCount = enemies->count;
+    memcpy(snapshot->enemyX, enemies->x, enemies->count * sizeof(float));
+    memcpy(snapshot->enemyY, enemies->y, enemies->count * sizeof(float));
+    snapshot->bulletCount = bullets.count;
+    memcpy(snapshot->bulletX, bullets.x, bullets.count * sizeof(float));
+    memcpy(snapshot->bulletY, bullets.y, bullets.count * sizeof(float));
+    snapshot->kills.count = world->kills.count;
+    memcpy(snapshot->kills.x, world->kills.x, world->kills.count * sizeof(float));
+    memcpy(snapshot->kills.y, world->kills.y, world->kills.count * sizeof(float));
+    snapshot->volleys = world->volleys;
+}
+
+void freeSnapshot(WorldSnapshot* snapshot) {
+    SDL_free(snapshot->enemyX);
+    SDL_free(snapshot->enemyY);
+    SDL_free(snapshot->bulletX);
+    SDL_free(snapshot->bulletY);
+    *snapshot = (WorldSnapshot){ 0 };
+}
+
+// Everything in the world, drawn over the background between beginScene()
+// and endScene(). Late input sampling leaves out the player and draws it
+// just before the frame is presented.
+void renderWorld(const WorldSnapshot* snapshot, bool withPlayer) {
+    SDL_Color white = { 255, 255, 255, 255 };
+    renderParticles(&particles);
+
+    // All sprites share the atlas, so the world is a single geometry submission
+    if (withPlayer) {
+        batchSprite(&spriteBatch, SPRITE_PLAYER, (int)snapshot->player.x, (int)snapshot->player.y,
+            PLAYER_SIZE, PLAYER_SIZE, white);
+    }
+
+    reserveBatch(&spriteBatch, spriteBatch.quadCount + snapshot->enemyCount);
+    for (int i = 0; i < snapshot->enemyCount; i++) {
+        batchSprite(&spriteBatch, SPRITE_ENEMY, (int)snapshot->enemyX[i], (int)snapshot->enemyY[i],
+            ENEMY_SIZE, ENEMY_SIZE, white);
+    }
+ 
+    renderHPBar(&spriteBatch, &snapshot->player);
+
+    // Render revolving red dot
+    batchSprite(&spriteBatch, SPRITE_FIREBALL, (int)snapshot->redDotX - RED_DOT_RADIUS,
+        (int)snapshot->redDotY - RED_DOT_RADIUS, RED_DOT_RADIUS * 2, RED_DOT_RADIUS * 2, white);
+
+    renderBullets(&spriteBatch, snapshot);
+    flushBatch(&spriteBatch);
+}
+
+void renderHUD(const WorldSnapshot* snapshot) {
+    setLabelValue(&scoreLabel, "Score: %d", snapshot->score);
+    renderLabel(&scoreLabel);
+
+    setLabelValue(&highScoreLabel, "High Score: %d", getHighScore());
+    renderLabel(&highScoreLabel);
+}
+
+void render(const WorldSnapshot* snapshot, bool withPlayer) {
+    beginScene();
+    SDL_RenderClear(renderer);
+    renderBackground();
+    renderWorld(snapshot, withPlayer);
+    endScene();
+    renderHUD(snapshot);
+}
+
+// The software renderer's version of render(): marks where everything is
+// drawn, restores the background under that and under the last frame's
+// drawing, then draws the frame over it. presentFrame() only sends those
+// parts to the window. With late input sampling, lateReach is how far from
+// its snapshot position the player may still be drawn after this returns;
+// zero draws it here. Returns false when the frame has to go through
+// render() instead.
+bool renderDirtyFrame(DirtyRenderer* dirty, const WorldSnapshot* snapshot, float lateReach) {
+    if (!dirty->enabled || profiler.overlayVisible) {
+        return false;
+    }
+    updateSceneLayout();
+    SDL_Surface* surface = SDL_GetWindowSurface(window);
+    if (!surface || !dirty->background || dirty->background->w != scene.letterbox.w ||
+        dirty->background->h != scene.letterbox.h || dirty->background->format->format != surface->format->format) {
+        return false;  // until the texture cache has scaled the background to the window
+    }
+    layoutDirtyTiles(dirty, surface);
+
+    markDirtyWorld(dirty, (int)snapshot->player.x - lateReach, (int)snapshot->player.y - lateReach,
+        PLAYER_SIZE + lateReach * 2, PLAYER_SIZE + lateReach * 2);
+    for (int i = 0; i < snapshot->enemyCount; i++) {
+        markDirtyWorld(dirty, (int)snapshot->enemyX[i], (int)snapshot->enemyY[i], ENEMY_SIZE, ENEMY_SIZE);
+    }
+    markDirtyWorld(dirty, (int)snapshot->redDotX - RED_DOT_RADIUS, (int)snapshot->redDotY - RED_DOT_RADIUS,
+        RED_DOT_RADIUS * 2, RED_DOT_RADIUS * 2);
+    for (int i = 0; i < snapshot->bulletCount; i++) {
+        markDirtyWorld(dirty, (int)snapshot->bulletX[i] - BULLET_SIZE / 2, (int)snapshot->bulletY[i] - BULLET_SIZE / 2,
+            BULLET_SIZE, BULLET_SIZE);
+    }
+    for (int layer = 0; layer < PARTICLE_LAYER_COUNT; layer++) {
+        const ParticlePool* pool = &particles.layers[layer];
+        for (int i = 0; i < pool->count; i++) {
+            markDirtyWorld(dirty, pool->x[i] - PARTICLE_SIZE / 2.0f, pool->y[i] - PARTICLE_SIZE / 2.0f,
+                PARTICLE_SIZE, PARTICLE_SIZE);
+        }
+    }
+    // the HP bar is redrawn every frame, it is small
+    markDirtyWorld(dirty, (WORLD_WIDTH - 200) / 2, WORLD_HEIGHT - 30, 200, 20);
+    setLabelValue(&scoreLabel, "Score: %d", snapshot->score);
+    setLabelValue(&highScoreLabel, "High Score: %d", getHighScore());
+    markDirty(dirty, scoreLabel.x, scoreLabel.y, scoreLabel.x + scoreLabel.w + DIRTY_PADDING, scoreLabel.y + scoreLabel.h);
+    markDirty(dirty, highScoreLabel.x, highScoreLabel.y, highScoreLabel.x + highScoreLabel.w + DIRTY_PADDING,
+        highScoreLabel.y + highScoreLabel.h);
+
+    collectDirtyRects(dirty);
+    // nothing still queued may land on the window after its background is restored
+    SDL_RenderFlush(renderer);
+    SDL_SetClipRect(surface, NULL);
+    for (int i = 0; i < dirty->rectCount; i++) {
+        restoreDirtyRect(dirty, surface, &dirty->rects[i]);
+    }
+
+    beginScene();
+    renderWorld(snapshot, lateReach == 0);
+    endScene();
+    renderHUD(snapshot);
+    dirty->pending = true;
+    return true;
+}
+
+void renderGameOverText() {
+    setLabelPosition(&gameOverLabel, (SCREEN_WIDTH - gameOverLabel.w) / 2,
+        (SCREEN_HEIGHT - gameOverLabel.h) / 2);
+    renderLabel(&gameOverLabel);
+}
+
+// One frame of the game over screen. The frozen game state only needs
+// drawing when the window changes; either way the thread then sleeps until
+// the next event or IDLE_WAIT_MS.
+void gameOverFrame(const WorldSnapshot* snapshot, bool redraw) {
+    if (redraw) {
+        render(snapshot, true);
+        renderProfilerOverlay(snapshot);
+        renderGameOverText();
+        presentFrame();
+    }
+    PROFILE_BEGIN(ZONE_WAIT);
+    SDL_WaitEventTimeout(NULL, IDLE_WAIT_MS);
+    PROFILE_END(ZONE_WAIT);
+}
+
+void renderRoundedRect(SDL_Renderer* renderer, SDL_Rect rect, int radius) {
+    int cornerPoints = 0;
+    for (int y = 0; y < radius; y++) {
+        for (int x = 0; x < radius; x++) {
+            if (x * x + y * y <= radius * radius) cornerPoints++;
+        }
+    }
+    int edgeX = rect.w - 2 * radius > 0 ? rect.w - 2 * radius : 0;
+    int edgeY = rect.h - 2 * radius > 0 ? rect.h - 2 * radius : 0;
+    SDL_Point* points = frameAlloc((cornerPoints * 4 + edgeX * 2 + edgeY * 2) * sizeof(SDL_Point));
+    if (!points) {
+        return;
+    }
+    int count = 0;
+
+    // corner arcs
+    for (int y = 0; y < radius; y++) {
+        for (int x = 0; x < radius; x++) {
+            if (x * x + y * y <= radius * radius) {
+                points[count++] = (SDL_Point){ rect.x + x, rect.y + y }; // Top-left
+                points[count++] = (SDL_Point){ rect.x + rect.w - x - 1, rect.y + y }; // Top-right 
+                points[count++] = (SDL_Point){ rect.x + x, rect.y + rect.h - y - 1 }; // Bottom-left 
+                points[count++] = (SDL_Point){ rect.x + rect.w - x - 1, rect.y + rect.h - y - 1 }; // Bottom-right 
+            }
+        }
+    }
+
+    // top and bottom horizontal borders
+    for (int x = radius; x < rect.w - radius; x++) {
+        points[count++] = (SDL_Point){ rect.x + x, rect.y }; // Top border
+        points[count++] = (SDL_Point){ rect.x + x, rect.y + rect.h - 1 }; // Bottom border
+    }
+
+    // left and right vertical borders
+    for (int y = radius; y < rect.h - radius; y++) {
+        points[count++] = (SDL_Point){ rect.x, rect.y + y }; // Left border
+        points[count++] = (SDL_Point){ rect.x + rect.w - 1, rect.y + y }; // Right border
+    }
+
+    drawCallCount++;
+    SDL_RenderDrawPoints(renderer, points, count);
+}
+
+void initButton(Button* button, const char* text) {
+    *button = (Button){ .label = { .atlas = &fontAtlas, .color = { 255, 255, 255, 255 } }, .dirty = true };
+    setLabelText(&button->label, text);
+}
+
+void setButtonRect(Button* button, SDL_Rect rect) {
+    if (rect.w != button->rect.w || rect.h != button->rect.h) {
+        button->dirty = true;
+    }
+    button->rect = rect;
+}
+
+// Draws the border and label with the button's top-left corner at x, y.
+void paintButton(Button* button, int x, int y) {
+    SDL_Rect rect = { x, y, button->rect.w, button->rect.h };
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255); // White
+    renderRoundedRect(renderer, rect, 10); 
+
+    setLabelPosition(&button->label, x + (rect.w - button->label.w) / 2,
+        y + (rect.h - button->label.h) / 2);
+    renderLabel(&button->label);
+}
+
+void buildButton(Button* button) {
+    SDL_DestroyTexture(button->texture);
+    button->texture = NULL;
+    button->dirty = false;
+    if (button->rect.w <= 0 || button->rect.h <= 0 || !SDL_RenderTargetSupported(renderer)) {
+        return;
+    }
+
+    button->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+        button->rect.w, button->rect.h);
+    if (!button->texture) {
+        return;
+    }
+    SDL_SetTextureBlendMode(button->texture, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderTarget(renderer, button->texture);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+    SDL_RenderClear(renderer);
+    paintButton(button, 0, 0);
+    SDL_SetRenderTarget(renderer, NULL);
+}
+
+void renderButton(Button* button) {
+    if (button->dirty) {
+        buildButton(button);
+    }
+    if (button->texture) {
+        drawTexture(button->texture, NULL, &button->rect);
+    } else {
+        // no render targets on this renderer, draw it directly
+        paintButton(button, button->rect.x, button->rect.y);
+    }
+}
+
+void destroyButton(Button* button) {
+    SDL_DestroyTexture(button->texture);
+    button->texture = NULL;
+}
+
+
+void updateButtonPositions(SDL_Rect* startButton, SDL_Rect* optionButton) {
+    int buttonWidth = SCREEN_WIDTH / 4;
+    int buttonHeight = SCREEN_HEIGHT / 10;
+    
+    *startButton = (SDL_Rect){
+        .x = SCREEN_WIDTH / 2 - buttonWidth / 2,
+        .y = SCREEN_HEIGHT / 2 - buttonHeight / 2, // -10 instead of /2
+        .w = buttonWidth,
+        .h = buttonHeight
+    };
+    
+    // *optionButton = (SDL_Rect){
+    //     .x = SCREEN_WIDTH / 2 - buttonWidth / 2,
+    //     .y = SCREEN_HEIGHT / 2 + 10,
+    //     .w = buttonWidth,
+    //     .h = buttonHeight
+    // };
+}
+
+// Moves every enemy a fixed step along its steering vector. All variants
+// perform the same IEEE operations in the same order, so they produce
+// identical positions and a run stays reproducible whichever one is picked.
+void advanceEnemiesScalar(EnemyPool* pool, float step) {
+    for (int i = 0; i < pool->count; i++) {
+        float dx = pool->steerX[i];
+        float dy = pool->steerY[i];
+        float distance = sqrtf(dx * dx + dy * dy);
+        if (distance != 0) {
+            dx /= distance;
+            dy /= distance;
+        }
+        pool->x[i] += dx * step;
+        pool->y[i] += dy * step;
+    }
+}
+
+#ifdef COTL_SSE2
+void advanceEnemiesSSE2(EnemyPool* pool, float step) {
+    __m128 vstep = _mm_set1_ps(step);
+    __m128 zero = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= pool->count; i += 4) {
+        __m128 x = _mm_loadu_ps(pool->x + i);
+        __m128 y = _mm_loadu_ps(pool->y + i);
+        __m128 dx = _mm_loadu_ps(pool->steerX + i);
+        __m128 dy = _mm_loadu_ps(pool->steerY + i);
+        __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+        __m128 moving = _mm_cmpneq_ps(distance, zero);
+        dx = _mm_or_ps(_mm_and_ps(moving, _mm_div_ps(dx, distance)), _mm_andnot_ps(moving, dx));
+        dy = _mm_or_ps(_mm_and_ps(moving, _mm_div_ps(dy, distance)), _mm_andnot_ps(moving, dy));
+        _mm_storeu_ps(pool->x + i, _mm_add_ps(x, _mm_mul_ps(dx, vstep)));
+        _mm_storeu_ps(pool->y + i, _mm_add_ps(y, _mm_mul_ps(dy, vstep)));
+    }
+    EnemyPool tail = { pool->x + i, pool->y + i, pool->steerX + i, pool->steerY + i, pool->alive + i, pool->count - i, 0 };
+    advanceEnemiesScalar(&tail, step);
+}
+#endif
+
+#ifdef COTL_AVX2
+__attribute__((target("avx2")))
+void advanceEnemiesAVX2(EnemyPool* pool, float step) {
+    __m256 vstep = _mm256_set1_ps(step);
+    __m256 zero = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= pool->count; i += 8) {
+        __m256 x = _mm256_loadu_ps(pool->x + i);
+        __m256 y = _mm256_loadu_ps(pool->y + i);
+        __m256 dx = _mm256_loadu_ps(pool->steerX + i);
+        __m256 dy = _mm256_loadu_ps(pool->steerY + i);
+        __m256 distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+        __m256 moving = _mm256_cmp_ps(distance, zero, _CMP_NEQ_UQ);
+        dx = _mm256_blendv_ps(dx, _mm256_div_ps(dx, distance), moving);
+        dy = _mm256_blendv_ps(dy, _mm256_div_ps(dy, distance), moving);
+        _mm256_storeu_ps(pool->x + i, _mm256_add_ps(x, _mm256_mul_ps(dx, vstep)));
+        _mm256_storeu_ps(pool->y + i, _mm256_add_ps(y, _mm256_mul_ps(dy, vstep)));
+    }
+    EnemyPool tail = { pool->x + i, pool->y + i, pool->steerX + i, pool->steerY + i, pool->alive + i, pool->count - i, 0 };
+    advanceEnemiesScalar(&tail, step);
+}
+#endif
+
+void selectEnemyKernel() {
+    advanceEnemies = advanceEnemiesScalar;
+#ifdef COTL_SSE2
+    advanceEnemies = advanceEnemiesSSE2;
+#endif
+#ifdef COTL_AVX2
+    if (SDL_HasAVX2()) {
+        advanceEnemies = advanceEnemiesAVX2;
+    }
+#endif
+}
+
+typedef struct {
+    EnemyPool* enemies;
+    const SpatialGrid* grid;
+    float targetX, targetY;  // player center
+    float step;
+} EnemyMove;
+
+typedef struct {
+    int self;
+    float x, y;
+    float pushX, pushY;
+    int neighbors, checks;
+} Separation;
+
+// Adds the push from the enemies in one cell. Returns false once enough
+// neighbours have been looked at.
+bool separateFromCell(const SpatialGrid* grid, int cell, Separation* separation) {
+    for (int k = grid->cellStart[cell]; k < grid->cellStart[cell + 1]; k++) {
+        int j = grid->items[k];
+        if (j == separation->self) continue;
+        if (++separation->checks > SEPARATION_MAX_CHECKS || separation->neighbors == SEPARATION_MAX_NEIGHBORS) {
+            return false;
+        }
+        float dx = separation->x - grid->itemX[k], dy = separation->y - grid->itemY[k];
+        float distanceSquared = dx * dx + dy * dy;
+        if (distanceSquared >= SEPARATION_RADIUS * SEPARATION_RADIUS) continue;
+        separation->neighbors++;
+        if (distanceSquared == 0) {
+            separation->pushX += separation->self < j ? 1.0f : -1.0f;  // stacked exactly: split them by index
+            continue;
+        }
+        // unit direction times (1 - distance / radius)
+        float scale = 1.0f / sqrtf(distanceSquared) - 1.0f / SEPARATION_RADIUS;
+        separation->pushX += dx * scale;
+        separation->pushY += dy * scale;
+    }
+    return true;
+}
+
+// Push away from the enemies overlapping this one, stronger the closer
+// they are. The enemy's own cell is scanned first and only the first few
+// neighbours count, so the cost per enemy stays flat however dense the
+// horde gets.
+void separationForce(const SpatialGrid* grid, int i, float x, float y, float* pushX, float* pushY) {
+    int x0 = gridCellCoord(x - SEPARATION_RADIUS, GRID_CELL_SIZE, grid->cols);
+    int y0 = gridCellCoord(y - SEPARATION_RADIUS, GRID_CELL_SIZE, grid->rows);
+    int x1 = gridCellCoord(x + SEPARATION_RADIUS, GRID_CELL_SIZE, grid->cols);
+    int y1 = gridCellCoord(y + SEPARATION_RADIUS, GRID_CELL_SIZE, grid->rows);
+    int home = gridCellCoord(y, GRID_CELL_SIZE, grid->rows) * grid->cols + gridCellCoord(x, GRID_CELL_SIZE, grid->cols);
+    Separation separation = { i, x, y, 0, 0, 0, 0 };
+
+    bool more = separateFromCell(grid, home, &separation);
+    for (int cy = y0; cy <= y1 && more; cy++) {
+        for (int cx = x0; cx <= x1 && more; cx++) {
+            int cell = cy * grid->cols + cx;
+            if (cell != home) {
+                more = separateFromCell(grid, cell, &separation);
+            }
+        }
+    }
+    *pushX = separation.pushX;
+    *pushY = separation.pushY;
+}
+
+// Reads positions only and writes each enemy's own heading, so it runs in
+// parallel before any enemy moves.
+void steerEnemyRange(void* data, int begin, int end, int worker) {
+    (void)worker;
+    EnemyMove* move = data;
+    EnemyPool* enemies = move->enemies;
+    for (int i = begin; i < end; i++) {
+        float cx = enemies->x[i] + ENEMY_SIZE / 2, cy = enemies->y[i] + ENEMY_SIZE / 2;
+        float dirX, dirY;
+        // next to the player the grid is too coarse, so close in directly
+        if (flowField.distance[flowCell(&flowField, cx, cy)] <= FLOW_DIAGONAL_COST) {
+            dirX = move->targetX - cx;
+            dirY = move->targetY - cy;
+            float distance = sqrtf(dirX * dirX + dirY * dirY);
+            if (distance != 0) {
+                dirX /= distance;
+                dirY /= distance;
+            }
+        } else {
+            sampleFlowField(&flowField, cx, cy, &dirX, &dirY);
+        }
+        float pushX, pushY;
+        separationForce(move->grid, i, cx, cy, &pushX, &pushY);
+        enemies->steerX[i] = dirX + pushX * SEPARATION_WEIGHT;
+        enemies->steerY[i] = dirY + pushY * SEPARATION_WEIGHT;
+    }
+}
+
+void advanceEnemyRange(void* data, int begin, int end, int worker) {
+    (void)worker;
+    EnemyMove* move = data;
+    EnemyPool* enemies = move->enemies;
+    EnemyPool range = { enemies->x + begin, enemies->y + begin, enemies->steerX + begin, enemies->steerY + begin,
+        enemies->alive + begin, end - begin, end - begin };
+    advanceEnemies(&range, move->step);
+}
+
+// Every enemy follows the shared flow field and keeps its distance from its
+// neighbours, at a fixed cost per enemy. Both passes are split across the
+// workers; the second only starts once every heading is known, so the
+// result does not depend on the thread count.
+void updateEnemyPositions(EnemyPool* enemies, 
+Entity* player, float deltaTime) {
+    float targetX = player->x + PLAYER_SIZE / 2, targetY = player->y + PLAYER_SIZE / 2;
+    buildFlowField(&flowField, targetX, targetY);
+    gridBuild(&enemyGrid, enemies);  // kills since the collision pass moved enemies around
+    EnemyMove move = { enemies, &enemyGrid, targetX, targetY, (float)ENEMY_SPEED * deltaTime };
+    parallelFor(steerEnemyRange, &move, enemies->count, STEER_JOB_GRAIN);
+    parallelFor(advanceEnemyRange, &move, enemies->count, ENEMY_JOB_GRAIN);
+}
+
+void fullScreen(SDL_Event *e){
+    if(e->key.keysym.sym == SDLK_f){
+        isFullScreen = !isFullScreen;
+        if (isFullScreen) {
+            SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN_DESKTOP);
+        } else {
+            SDL_SetWindowFullscreen(window, 0);
+            SDL_SetWindowSize(window, INITIAL_SCREEN_WIDTH, INITIAL_SCREEN_HEIGHT);
+        }        
+    }
+}
+
+void quitGame(SDL_Event *e){
+    if (e->type == SDL_QUIT) {
+        quit = true;
+        menuRunning = false;
+        running = false;
+        return;
+    }
+}
+
+void initWorld(World* world, Uint64 seed) {
+    world->rng = (Rng){ seed };
+    initFlowField(&flowField);
+    world->player = (Entity){ WORLD_WIDTH / 2, WORLD_HEIGHT / 2, PLAYER_SIZE, true, PLAYER_MAX_HP };
+    world->enemies.count = 0;
+    world->angle = 0.0f;
+    world->redDotX = world->player.x + PLAYER_SIZE / 2 + CIRCLE_RADIUS;
+    world->redDotY = world->player.y + PLAYER_SIZE / 2;
+    world->tick = 0;
+    world->damageCooldown = 0;
+    world->kills.count = 0;
+    world->volleys = 0;
+
+    // Everything a wave needs is allocated here rather than when it arrives
+    int capacity = largestWave();
+    reserveEnemies(&world->enemies, capacity);
+    reserveGrid(&enemyGrid, capacity);
+    reserveJobScratch(enemyGrid.itemCapacity);
+    resetSpawnGrid(&spawnGrid, SPAWN_MIN_SPACING);  // the most cells any wave can need
+    startWave(world, 0);
+
+    score = 0;
+    ENEMY_SPEED = INITIAL_ENEMY_SPEED;
+    gameOver = false;
+    bullets.count = 0;
+    reserveBullets(&bullets, options.bulletLimit);
+}
+
+// Shared with client-side prediction, which has to move the player exactly
+// the way the server does.
+void movePlayer(Entity* player, Uint8 move) {
+    if (move & INPUT_UP) player->y -= SPEED * simDt;
+    if (move & INPUT_DOWN) player->y += SPEED * simDt;
+    if (move & INPUT_LEFT) player->x -= SPEED * simDt;
+    if (move & INPUT_RIGHT) player->x += SPEED * simDt;
+
+    if (player->x < 0) player->x = 0;
+    if (player->x > WORLD_WIDTH - PLAYER_SIZE) player->x = WORLD_WIDTH - PLAYER_SIZE;
+    if (player->y < 0) player->y = 0;
+    if (player->y > WORLD_HEIGHT - PLAYER_SIZE) player->y = WORLD_HEIGHT - PLAYER_SIZE;
+}
+
+// The dot is tested along the whole arc it covered this tick.
+bool dotTouchesEnemy(const EnemyPool* enemies, int i, float playerX, float playerY, float previousAngle, float sweep) {
+    return sweepArcCircle(playerX, playerY, CIRCLE_RADIUS, previousAngle, sweep,
+        enemies->x[i] + ENEMY_SIZE / 2, enemies->y[i] + ENEMY_SIZE / 2, RED_DOT_RADIUS + ENEMY_SIZE / 2);
+}
+
+bool playerTouchesEnemy(const EnemyPool* enemies, int i, const Entity* player) {
+    return checkCollision(player->x + PLAYER_SIZE / 2, player->y + PLAYER_SIZE / 2, PLAYER_SIZE,
+        enemies->x[i] + ENEMY_SIZE / 2, enemies->y[i] + ENEMY_SIZE / 2, ENEMY_SIZE);
+}
+
+// Whether the dot or the player touches live enemy i this tick.
+bool touchesEnemy(const EnemyPool* enemies, int i, const Entity* player, float previousAngle, float sweep) {
+    float playerX = player->x + PLAYER_SIZE / 2;
+    float playerY = player->y + PLAYER_SIZE / 2;
+    return enemies->alive[i] && (dotTouchesEnemy(enemies, i, playerX, playerY, previousAngle, sweep) ||
+        playerTouchesEnemy(enemies, i, player));
+}
+
+// --verify-grid: before the collision pass changes anything, runs every
+// query the pass will make through the grid and again over all enemies,
+// and counts each query whose results differ. The player's query must
+// find exactly the enemies the dot or the player touch, and each bullet
+// the same earliest hit.
+void verifyGridQueries(const World* world, float previousAngle, float sweep, float reach) {
+    const EnemyPool* enemies = &world->enemies;
+    const Entity* player = &world->player;
+    float playerX = player->x + PLAYER_SIZE / 2;
+    float playerY = player->y + PLAYER_SIZE / 2;
+    int* results = enemyGrid.results;
+    int found = gridQuery(&enemyGrid, playerX - reach, playerY - reach, playerX + reach, playerY + reach, results);
+    // the touched enemies among the grid's results, then among all of them in the same order
+    int touched = 0;
+    for (int k = 0; k < found; k++) {
+        if (touchesEnemy(enemies, results[k], player, previousAngle, sweep)) results[touched++] = results[k];
+    }
+    bool matched = true;
+    int expected = 0;
+    for (int j = 0; j < enemies->count; j++) {
+        if (touchesEnemy(enemies, j, player, previousAngle, sweep)) {
+            matched = matched && expected < touched && results[expected] == j;
+            expected++;
+        }
+    }
+    matched = matched && expected == touched;
+    gridCheck.queries++;
+    if (!matched) {
+        gridCheck.mismatches++;
+        SDL_Log("tick %u: the grid's player query differs from brute force", world->tick);
+    }
+
+    BulletQuery query = { enemies, &enemyGrid, simDt };
+    for (int i = 0; i < bullets.count; i++) {
+        int gridHit = firstBulletHit(&query, i, results);
+        int bruteHit = earliestBulletHit(&query, i, NULL, enemies->count);
+        gridCheck.queries++;
+        if (gridHit != bruteHit) {
+            gridCheck.mismatches++;
+            SDL_Log("tick %u: bullet %d hits enemy %d through the grid but %d by brute force",
+                world->tick, i, gridHit, bruteHit);
+        }
+    }
+}
+
+// Advances the game by exactly one tick of simDt. Touches no SDL state,
+// so it runs the same with or without a window.
+void simStep(World* world, const SimInput* input) {
+    Entity* player = &world->player;
+    EnemyPool* enemies = &world->enemies;
+
+    if (input->fire) {
+        int fired = bullets.count;
+        shootBullets(player->x + PLAYER_SIZE / 2, player->y + PLAYER_SIZE / 2,
+            input->fireX, input->fireY, calculateNumBullets());
+        if (bullets.count > fired) world->volleys++;
+    }
+
+    movePlayer(player, input->move);
+
+    // Revolving red dot, wrapped so long sessions keep full float precision
+    float previousAngle = world->angle;
+    float sweep = 2.0f * PI * simDt;
+    world->angle += sweep;
+    if (world->angle >= 2.0f * PI) world->angle -= 2.0f * PI;
+    world->redDotX = player->x + PLAYER_SIZE / 2 + CIRCLE_RADIUS * cosf(world->angle);
+    world->redDotY = player->y + PLAYER_SIZE / 2 + CIRCLE_RADIUS * sinf(world->angle);
+
+    if (world->damageCooldown > 0) world->damageCooldown--;
+
+    // Check collisions against every enemy near the player or the red dot
+    PROFILE_BEGIN(ZONE_COLLISION);
+    gridBuild(&enemyGrid, enemies);
+    float playerX = player->x + PLAYER_SIZE / 2;
+    float playerY = player->y + PLAYER_SIZE / 2;
+    float reach = CIRCLE_RADIUS + RED_DOT_RADIUS > PLAYER_SIZE / 2 ? CIRCLE_RADIUS + RED_DOT_RADIUS : PLAYER_SIZE / 2;
+    if (options.verifyGrid) {
+        verifyGridQueries(world, previousAngle, sweep, reach);
+    }
+    int found = gridQuery(&enemyGrid, playerX - reach, playerY - reach, playerX + reach, playerY + reach, enemyGrid.results);
+    for (int k = 0; k < found; k++) {
+        int i = enemyGrid.results[k];
+        if (enemies->alive[i] && dotTouchesEnemy(enemies, i, playerX, playerY, previousAngle, sweep)) {
+            enemies->alive[i] = false;
+            score++;
+            ENEMY_SPEED+= 1.5;
+        }
+
+        if (enemies->alive[i] && playerTouchesEnemy(enemies, i, player)) {
+            if (world->damageCooldown == 0) {
+                player->hp--;
+                world->damageCooldown = damageCooldownTicks;
+            }
+            if (player->hp <= 0) {
+                gameOver = true;
+                break;
+            }
+        }
+    }
+
+    checkBulletCollisions(enemies, &enemyGrid, simDt);
+    removeDeadEnemies(enemies, &world->kills);
+    PROFILE_END(ZONE_COLLISION);
+
+    updateWaves(world);
+
+    // Enemy chase player
+    PROFILE_BEGIN(ZONE_ENEMIES);
+    updateEnemyPositions(enemies, player, simDt);
+    PROFILE_END(ZONE_ENEMIES);
+
+    PROFILE_BEGIN(ZONE_BULLETS);
+    updateBullets(simDt);
+    PROFILE_END(ZONE_BULLETS);
+
+    world->tick++;
+}
+
+Uint64 hashBytes(Uint64 hash, const void* data, size_t length) {
+    const Uint8* bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// FNV-1a over everything the simulation owns, for comparing two runs.
+Uint64 hashWorld(const World* world) {
+    Uint64 hash = 0xCBF29CE484222325ull;
+    hash = hashBytes(hash, &world->player.x, sizeof(float) * 2);
+    hash = hashBytes(hash, &world->player.hp, sizeof(int));
+    hash = hashBytes(hash, world->enemies.x, world->enemies.count * sizeof(float));
+    hash = hashBytes(hash, world->enemies.y, world->enemies.count * sizeof(float));
+    hash = hashBytes(hash, bullets.x, bullets.count * sizeof(float));
+    hash = hashBytes(hash, bullets.y, bullets.count * sizeof(float));
+    hash = hashBytes(hash, &world->angle, sizeof(float));
+    hash = hashBytes(hash, &score, sizeof(int));
+    hash = hashBytes(hash, &ENEMY_SPEED, sizeof(int));
+    return hash;
+}
+
+Uint8 readMoveInput() {
+    const Uint8* state = SDL_GetKeyboardState(NULL);
+    Uint8 move = 0;
+    if (state[SDL_SCANCODE_W]) move |= INPUT_UP;
+    if (state[SDL_SCANCODE_S]) move |= INPUT_DOWN;
+    if (state[SDL_SCANCODE_A]) move |= INPUT_LEFT;
+    if (state[SDL_SCANCODE_D]) move |= INPUT_RIGHT;
+    return move;
+}
+
+bool isMoveKeyEvent(const SDL_Event* e) {
+    if ((e->type != SDL_KEYDOWN && e->type != SDL_KEYUP) || e->key.repeat) {
+        return false;
+    }
+    SDL_Scancode key = e->key.keysym.scancode;
+    return key == SDL_SCANCODE_W || key == SDL_SCANCODE_S || key == SDL_SCANCODE_A || key == SDL_SCANCODE_D;
+}
+
+// Moves an event's millisecond timestamp onto the performance counter, the
+// clock the present is timed with.
+Uint64 eventCounter(const SDL_Event* e) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    Sint32 age = (Sint32)(SDL_GetTicks() - e->common.timestamp);
+    Uint64 back = age > 0 ? (Uint64)age * SDL_GetPerformanceFrequency() / 1000 : 0;
+    return back < now ? now - back : now;
+}
+
+void addInputStamp(InputStamps* stamps, Uint64 time) {
+    if (stamps->count < MAX_INPUT_STAMPS) {
+        stamps->times[stamps->count++] = time;
+    }
+}
+
+// Called right after a present with the input that frame was the first to show.
+void recordInputLatency(InputLatency* latency, InputStamps* stamps, Uint64 presented) {
+    double toMs = 1000.0 / SDL_GetPerformanceFrequency();
+    for (int i = 0; i < stamps->count; i++) {
+        Uint64 age = presented > stamps->times[i] ? presented - stamps->times[i] : 0;
+        latency->samples[latency->total++ % LATENCY_SAMPLES] = (float)(age * toMs);
+    }
+    stamps->count = 0;
+}
+
+// Percentiles over the newest LATENCY_SAMPLES events; false before any.
+bool inputLatencyPercentiles(InputLatency* latency, float* p50, float* p99) {
+    int count = latency->total < LATENCY_SAMPLES ? (int)latency->total : LATENCY_SAMPLES;
+    if (count == 0) {
+        return false;
+    }
+    memcpy(latency->sorted, latency->samples, count * sizeof(float));
+    qsort(latency->sorted, count, sizeof(float), compareFloats);
+    *p50 = latency->sorted[count / 2];
+    *p99 = latency->sorted[count * 99 / 100];
+    return true;
+}
+
+// Late input sampling: right before the frame is presented, picks up the
+// key events that came in while it was being drawn and draws the player
+// where the newest keys take it over the ticks this frame covers. Only the
+// drawing is predicted; the simulation takes the keys on the next frame,
+// the way it would have anyway.
+void renderLatePlayer(InputLatency* latency, const WorldSnapshot* snapshot, int ticks) {
+    SDL_PumpEvents();
+    SDL_Event events[MAX_INPUT_STAMPS];
+    int count = SDL_PeepEvents(events, MAX_INPUT_STAMPS, SDL_PEEKEVENT, SDL_KEYDOWN, SDL_KEYUP);
+    // still queued, so the next poll will see them again; it skips the ones counted here
+    int seen = 0;
+    for (int i = 0; i < count; i++) {
+        if (isMoveKeyEvent(&events[i]) && seen++ >= latency->lateStamped) {
+            addInputStamp(&latency->presenting, eventCounter(&events[i]));
+        }
+    }
+    if (seen > latency->lateStamped) latency->lateStamped = seen;
+
+    Entity player = snapshot->player;
+    Uint8 move = readMoveInput();
+    for (int i = 0; i < ticks; i++) {
+        movePlayer(&player, move);
+    }
+    // in window pixels, over the finished frame
+    SDL_RenderSetViewport(renderer, &scene.letterbox);
+    SDL_RenderSetScale(renderer, (float)scene.letterbox.w / WORLD_WIDTH, (float)scene.letterbox.h / WORLD_HEIGHT);
+    batchSprite(&spriteBatch, SPRITE_PLAYER, (int)player.x, (int)player.y, PLAYER_SIZE, PLAYER_SIZE,
+        (SDL_Color){ 255, 255, 255, 255 });
+    flushBatch(&spriteBatch);
+    SDL_RenderSetScale(renderer, 1.0f, 1.0f);
+    SDL_RenderSetViewport(renderer, NULL);
+}
+
+void setTickRate(int rate) {
+    simTickRate = rate;
+    simDt = 1.0f / simTickRate;
+    damageCooldownTicks = simTickRate / 2;  // 500 ms
+}
+
+Uint8* writeVarint(Uint8* out, Uint64 value) {
+    while (value >= 0x80) {
+        *out++ = (Uint8)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (Uint8)value;
+    return out;
+}
+
+bool readVarint(ReplayPlayer* replay, Uint64* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && replay->offset < replay->size; shift += 7) {
+        Uint8 byte = replay->data[replay->offset++];
+        *value |= (Uint64)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Uint64 zigzag(Sint32 value) {
+    return ((Uint32)value << 1) ^ (Uint32)(value >> 31);
+}
+
+Sint32 unzigzag(Uint64 value) {
+    return (Sint32)(value >> 1) ^ -(Sint32)(value & 1);
+}
+
+Uint8* writeReplayTag(Uint8* out, int tag, Uint8 move, Uint64 count) {
+    return writeVarint(out, count << 6 | (Uint64)move << 2 | (Uint64)tag);
+}
+
+// The header holds every setting that changes how a game plays.
+bool startRecording(ReplayRecorder* recorder, const char* path) {
+    recorder->file = fopen(path, "wb");
+    if (!recorder->file) {
+        fprintf(stderr, "Could not write %s\n", path);
+        return false;
+    }
+    Uint8 header[4 + 5 * 10 + MAX_WAVE_DEFINITIONS * 20];
+    writeU32(header, REPLAY_MAGIC);
+    Uint8* p = writeVarint(header + 4, REPLAY_VERSION);
+    p = writeVarint(p, (Uint64)simTickRate);
+    p = writeVarint(p, (Uint64)options.waveSize);
+    p = writeVarint(p, (Uint64)options.bulletLimit);
+    p = writeVarint(p, (Uint64)options.waveCount);
+    for (int i = 0; i < options.waveCount; i++) {
+        p = writeVarint(p, (Uint64)options.waves[i].count);
+        p = writeVarint(p, (Uint64)options.waves[i].spawnTicks);
+    }
+    fwrite(header, 1, p - header, recorder->file);
+    return true;
+}
+
+void flushReplayRun(ReplayRecorder* recorder) {
+    if (recorder->run == 0) {
+        return;
+    }
+    Uint8 record[REPLAY_MAX_RECORD];
+    Uint8* end = writeReplayTag(record, REPLAY_RUN, recorder->move, recorder->run);
+    fwrite(record, 1, end - record, recorder->file);
+    recorder->run = 0;
+}
+
+void recordInput(ReplayRecorder* recorder, const SimInput* input) {
+    if (!recorder->file) {
+        return;
+    }
+    if (input->fire) {
+        // aim points must come back bit for bit; ones off the click grid are stored raw
+        float stepsX = roundf(input->fireX * REPLAY_AIM_SCALE);
+        float stepsY = roundf(input->fireY * REPLAY_AIM_SCALE);
+        bool snapped = fabsf(stepsX) < (1 << 24) && fabsf(stepsY) < (1 << 24);
+        Sint32 snappedX = snapped ? (Sint32)stepsX : 0;
+        Sint32 snappedY = snapped ? (Sint32)stepsY : 0;
+        float x = (float)snappedX / REPLAY_AIM_SCALE;
+        float y = (float)snappedY / REPLAY_AIM_SCALE;
+        snapped = snapped && memcmp(&x, &input->fireX, sizeof(x)) == 0 && memcmp(&y, &input->fireY, sizeof(y)) == 0;
+        flushReplayRun(recorder);
+        Uint8 record[REPLAY_MAX_RECORD];
+        Uint8* end = writeReplayTag(record, REPLAY_SHOT, input->move, snapped);
+        if (snapped) {
+            end = writeVarint(end, zigzag(snappedX));
+            end = writeVarint(end, zigzag(snappedY));
+        } else {
+            Uint32 bits;
+            memcpy(&bits, &input->fireX, sizeof(bits));
+            writeU32(end, bits);
+            memcpy(&bits, &input->fireY, sizeof(bits));
+            writeU32(end + 4, bits);
+            end += 8;
+        }
+        fwrite(record, 1, end - record, recorder->file);
+        return;
+    }
+    if (input->move != recorder->move) {
+        flushReplayRun(recorder);
+        recorder->move = input->move;
+    }
+    recorder->run++;
+}
+
+void recordGameStart(ReplayRecorder* recorder, Uint64 seed) {
+    if (!recorder->file) {
+        return;
+    }
+    Uint8 record[REPLAY_MAX_RECORD];
+    Uint8* end = writeVarint(writeReplayTag(record, REPLAY_GAME, 0, 0), seed);
+    fwrite(record, 1, end - record, recorder->file);
+}
+
+// Called whenever a game stops, so a crash loses at most the game in progress.
+void recordGameEnd(ReplayRecorder* recorder, Uint64 hash) {
+    if (!recorder->file) {
+        return;
+    }
+    flushReplayRun(recorder);
+    Uint8 record[REPLAY_MAX_RECORD];
+    Uint8* end = writeReplayTag(record, REPLAY_END, 0, 0);
+    writeU64(end, hash);
+    fwrite(record, 1, end + 8 - record, recorder->file);
+    fflush(recorder->file);
+}
+
+void stopRecording(ReplayRecorder* recorder) {
+    if (recorder->file) {
+        fclose(recorder->file);
+        recorder->file = NULL;
+    }
+}
+
+// The recorded settings replace whatever the command line chose.
+bool loadReplay(ReplayPlayer* replay, const char* path) {
+    replay->data = SDL_LoadFile(path, &replay->size);
+    if (!replay->data) {
+        fprintf(stderr, "Could not load %s: %s\n", path, SDL_GetError());
+        return false;
+    }
+    Uint64 version = 0, tickRate = 0, waveSize = 0, bulletLimit = 0, waveCount = 0;
+    replay->offset = 4;
+    bool ok = replay->size >= 4 && readU32(replay->data) == REPLAY_MAGIC &&
+        readVarint(replay, &version) && version == REPLAY_VERSION &&
+        readVarint(replay, &tickRate) && tickRate > 0 && tickRate <= 10000 &&
+        readVarint(replay, &waveSize) && waveSize > 0 && waveSize <= REPLAY_MAX_SETTING &&
+        readVarint(replay, &bulletLimit) && bulletLimit > 0 && bulletLimit <= REPLAY_MAX_SETTING &&
+        readVarint(replay, &waveCount) && waveCount <= MAX_WAVE_DEFINITIONS;
+    // options only change once the whole header has checked out
+    WaveDefinition waves[MAX_WAVE_DEFINITIONS];
+    for (int i = 0; ok && i < (int)waveCount; i++) {
+        Uint64 count = 0, spawnTicks = 0;
+        ok = readVarint(replay, &count) && count > 0 && count <= REPLAY_MAX_SETTING &&
+            readVarint(replay, &spawnTicks) && spawnTicks > 0 && spawnTicks <= REPLAY_MAX_SETTING;
+        waves[i] = (WaveDefinition){ (int)count, (int)spawnTicks };
+    }
+    if (!ok) {
+        fprintf(stderr, "%s is not a replay this version can play\n", path);
+        SDL_free(replay->data);
+        *replay = (ReplayPlayer){ 0 };
+        return false;
+    }
+    setTickRate((int)tickRate);
+    options.waveSize = (int)waveSize;
+    options.bulletLimit = (int)bulletLimit;
+    options.waveCount = (int)waveCount;
+    memcpy(options.waves, waves, options.waveCount * sizeof(WaveDefinition));
+    replay->playing = true;
+    return true;
+}
+
+void freeReplay(ReplayPlayer* replay) {
+    SDL_free(replay->data);
+    *replay = (ReplayPlayer){ 0 };
+}
+
+// Moves on to the next recorded game. False once there are none left,
+// after which the replay stays stopped.
+bool replayStartGame(ReplayPlayer* replay, Uint64* seed) {
+    Uint64 record;
+    replay->run = 0;
+    replay->gameEnded = false;
+    replay->hashKnown = false;
+    if (!replay->playing || !readVarint(replay, &record) || (record & 3) != REPLAY_GAME ||
+        !readVarint(replay, seed)) {
+        replay->playing = false;
+        return false;
+    }
+    replay->games++;
+    return true;
+}
+
+// The input for the current game's next tick, or false once it has none.
+// A file cut short ends the game where it stops.
+bool replayNextInput(ReplayPlayer* replay, SimInput* input) {
+    while (!replay->gameEnded && replay->run == 0) {
+        Uint64 record;
+        if (!readVarint(replay, &record)) {
+            replay->gameEnded = true;
+            break;
+        }
+        int tag = (int)(record & 3);
+        Uint8 move = (Uint8)((record >> 2) & 15);
+        if (tag == REPLAY_RUN) {
+            replay->move = move;
+            replay->run = record >> 6;
+        } else if (tag == REPLAY_SHOT && record >> 6 == 1) {
+            Uint64 x, y;
+            if (!readVarint(replay, &x) || !readVarint(replay, &y)) {
+                replay->gameEnded = true;
+                break;
+            }
+            *input = (SimInput){ move, true, (float)unzigzag(x) / REPLAY_AIM_SCALE,
+                (float)unzigzag(y) / REPLAY_AIM_SCALE };
+            return true;
+        } else if (tag == REPLAY_SHOT && record >> 6 == 0 && replay->offset + 8 <= replay->size) {
+            Uint32 x = readU32(replay->data + replay->offset);
+            Uint32 y = readU32(replay->data + replay->offset + 4);
+            replay->offset += 8;
+            *input = (SimInput){ move, true, 0, 0 };
+            memcpy(&input->fireX, &x, sizeof(x));
+            memcpy(&input->fireY, &y, sizeof(y));
+            return true;
+        } else if (tag == REPLAY_END && replay->offset + 8 <= replay->size) {
+            replay->expectedHash = readU64(replay->data + replay->offset);
+            replay->offset += 8;
+            replay->hashKnown = true;
+            replay->gameEnded = true;
+        } else {
+            replay->gameEnded = true;
+            replay->playing = false;  // not a record this version wrote
+        }
+    }
+    if (replay->gameEnded) {
+        return false;
+    }
+    replay->run--;
+    *input = (SimInput){ replay->move, false, 0, 0 };
+    return true;
+}
+
+// Checks a stopped game against the recording: it must have used up its
+// input and ended in the recorded state. A game the player stopped
+// watching partway gets no verdict.
+void replayEndGame(ReplayPlayer* replay, Uint64 hash, bool stoppedEarly) {
+    SimInput input;
+    bool leftover = false;
+    while (replayNextInput(replay, &input)) {
+        leftover = true;
+    }
+    if (leftover && stoppedEarly) {
+        return;
+    }
+    if (leftover || (replay->hashKnown && hash != replay->expectedHash)) {
+        replay->diverged = true;
+        fprintf(stderr, "Replay diverged from the recording in game %d\n", replay->games);
+    }
+}
+
+// The seed for the next game: the recorded one while a replay plays, the
+// session's otherwise. Either way it starts the game's recording.
+Uint64 nextGameSeed(Rng* sessionRng) {
+    Uint64 seed = rngNext(sessionRng);
+    if (replay.playing && !replayStartGame(&replay, &seed)) {
+        printf("Replay finished after %d games%s\n", replay.games, replay.diverged ? ", diverged" : "");
+    }
+    recordGameStart(&recorder, seed);
+    return seed;
+}
+
+// Scripted player for headless runs: wanders and fires at the first live enemy.
+void botInput(const World* world, Rng* rng, SimInput* input) {
+    if (world->tick % 30 == 0) {
+        input->move = (Uint8)(rngNext(rng) & (INPUT_UP | INPUT_DOWN | INPUT_LEFT | INPUT_RIGHT));
+    }
+    input->fire = false;
+    if (world->tick % 15 == 0) {
+        if (world->enemies.count > 0) {
+            input->fire = true;
+            input->fireX = world->enemies.x[0] + ENEMY_SIZE / 2;
+            input->fireY = world->enemies.y[0] + ENEMY_SIZE / 2;
+        }
+    }
+}
+
+int runHeadless() {
+    Rng sessionRng = { options.seed };
+    Rng botRng = { options.seed ^ 0x9E3779B97F4A7C15ull };
+    World world = { 0 };
+    SimInput input = { 0 };
+    Uint64 hash = 0;
+    int games = 1;
+    int bestScore = 0;
+
+    initProfiler(options.tracePath != NULL);
+    initWorld(&world, nextGameSeed(&sessionRng));
+    allocCheckWarmup();
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (Uint64 tick = 0; tick < options.ticks; tick++) {
+        botInput(&world, &botRng, &input);
+        recordInput(&recorder, &input);
+        simStep(&world, &input);
+        profiler.frame++;
+        if (gameOver) {
+            if (score > bestScore) bestScore = score;
+            hash = hashBytes(hash, &score, sizeof(int));
+            recordGameEnd(&recorder, hashWorld(&world));
+            initWorld(&world, nextGameSeed(&sessionRng));
+            allocCheckWarmup();
+            games++;
+        }
+        allocCheckFrame();
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    recordGameEnd(&recorder, hashWorld(&world));
+    hash ^= hashWorld(&world);
+    freeEnemies(&world.enemies);
+    freeBullets(&bullets);
+    shutdownProfiler();
+
+    printf("seed=%llu ticks=%llu games=%d best_score=%d score=%d hp=%d hash=%016llx ticks_per_sec=%.0f\n",
+        (unsigned long long)options.seed, (unsigned long long)options.ticks, games, bestScore,
+        score, world.player.hp, (unsigned long long)hash, seconds > 0 ? options.ticks / seconds : 0.0);
+    return 0;
+}
+
+// Plays two headless sessions from each of GRID_CHECK_SEEDS seeds with
+// every grid query checked against brute force: one with the configured
+// waves and one with a horde, big enough that bullets are unlocked and
+// cells are crowded. Fails on any difference.
+int runGridCheck() {
+    Uint64 seed = options.seed;
+    Uint64 ticks = options.ticks;
+    int waveSize = options.waveSize;
+    int waveCount = options.waveCount;
+    options.ticks = GRID_CHECK_TICKS;
+    for (int i = 0; i < GRID_CHECK_SEEDS * 2; i++) {
+        options.seed = seed + i / 2;
+        options.waveSize = i % 2 ? GRID_CHECK_HORDE : waveSize;
+        options.waveCount = i % 2 ? 0 : waveCount;
+        runHeadless();
+    }
+    options.seed = seed;
+    options.ticks = ticks;
+    options.waveSize = waveSize;
+    options.waveCount = waveCount;
+    printf("grid_check seeds=%d queries=%llu mismatches=%llu\n", GRID_CHECK_SEEDS,
+        (unsigned long long)gridCheck.queries, (unsigned long long)gridCheck.mismatches);
+    return gridCheck.mismatches > 0 ? 1 : 0;
+}
+
+// Plays a recording as fast as the simulation allows, checking every game
+// against it. The tick rate doubles as a benchmark of that exact session.
+int runReplay() {
+    World world = { 0 };
+    Rng sessionRng = { 0 };
+    Uint64 ticks = 0;
+    Uint64 hash = 0;
+    int bestScore = 0;
+
+    initProfiler(options.tracePath != NULL);
+    Uint64 start = SDL_GetPerformanceCounter();
+    while (replay.playing) {
+        Uint64 seed = nextGameSeed(&sessionRng);
+        if (!replay.playing) {
+            break;
+        }
+        initWorld(&world, seed);
+        allocCheckWarmup();
+        SimInput input;
+        while (!gameOver && replayNextInput(&replay, &input)) {
+            recordInput(&recorder, &input);
+            simStep(&world, &input);
+            ticks++;
+            profiler.frame++;
+            allocCheckFrame();
+        }
+        if (score > bestScore) bestScore = score;
+        if (gameOver) {
+            hash = hashBytes(hash, &score, sizeof(int));  // folded like runHeadless() does
+        }
+        recordGameEnd(&recorder, hashWorld(&world));
+        replayEndGame(&replay, hashWorld(&world), false);
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    hash ^= hashWorld(&world);
+    freeEnemies(&world.enemies);
+    freeBullets(&bullets);
+    shutdownProfiler();
+
+    printf("replay=%s games=%d ticks=%llu best_score=%d hash=%016llx ticks_per_sec=%.0f %s\n",
+        options.replayPath, replay.games, (unsigned long long)ticks, bestScore, (unsigned long long)hash,
+        seconds > 0 ? ticks / seconds : 0.0, replay.diverged ? "DIVERGED" : "MATCH");
+    return replay.diverged ? 1 : 0;
+}
+
+void writeBits(BitStream* stream, Uint32 value, int count) {
+    if (stream->bit + count > stream->size) {
+        stream->overflow = true;
+        return;
+    }
+    while (count > 0) {
+        int shift = stream->bit & 7;
+        int take = 8 - shift < count ? 8 - shift : count;
+        Uint8 mask = (Uint8)(((1u << take) - 1) << shift);
+        Uint8* byte = &stream->data[stream->bit >> 3];
+        *byte = (Uint8)((*byte & ~mask) | ((value << shift) & mask));
+        value >>= take;
+        stream->bit += take;
+        count -= take;
+    }
+}
+
+Uint32 readBits(BitStream* stream, int count) {
+    if (stream->bit + count > stream->size) {
+        stream->overflow = true;
+        return 0;
+    }
+    Uint32 value = 0;
+    for (int done = 0; done < count;) {
+        int shift = stream->bit & 7;
+        int take = 8 - shift < count - done ? 8 - shift : count - done;
+        value |= (Uint32)((stream->data[stream->bit >> 3] >> shift) & ((1u << take) - 1)) << done;
+        stream->bit += take;
+        done += take;
+    }
+    return value;
+}
+
+// Overwrites bits written earlier, e.g. a count only known afterwards.
+void patchBits(BitStream* stream, int position, Uint32 value, int count) {
+    int bit = stream->bit;
+    stream->bit = position;
+    writeBits(stream, value, count);
+    stream->bit = bit;
+}
+
+Uint16 quantizePosition(float v) {
+    int q = (int)lroundf(v * NET_POSITION_SCALE) + NET_POSITION_OFFSET;
+    return (Uint16)(q < 0 ? 0 : q > 65535 ? 65535 : q);
+}
+
+float dequantizePosition(Uint16 q) {
+    return (float)(q - NET_POSITION_OFFSET) / NET_POSITION_SCALE;
+}
+
+Uint16 quantizeAngle(float angle) {
+    return (Uint16)((int)(angle / (2.0f * PI) * (1 << NET_ANGLE_BITS) + 0.5f) & ((1 << NET_ANGLE_BITS) - 1));
+}
+
+float dequantizeAngle(Uint16 q) {
+    return q * (2.0f * PI) / (1 << NET_ANGLE_BITS);
+}
+
+// Same step as the red dot takes in simStep().
+float sweepAngle(float angle) {
+    angle += 2.0f * PI * simDt;
+    return angle >= 2.0f * PI ? angle - 2.0f * PI : angle;
+}
+
+// A 2-bit tag, then nothing for an unchanged position, a small or medium
+// delta against the baseline, or the absolute position.
+void writeEntity(BitStream* stream, Uint16 x, Uint16 y, Uint16 baseX, Uint16 baseY) {
+    int dx = x - baseX;
+    int dy = y - baseY;
+    int spread = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+    if (spread == 0) {
+        writeBits(stream, 0, 2);
+    } else if (spread < 1 << (NET_SMALL_DELTA_BITS - 1)) {
+        writeBits(stream, 1, 2);
+        writeBits(stream, (Uint32)(dx + (1 << (NET_SMALL_DELTA_BITS - 1))), NET_SMALL_DELTA_BITS);
+        writeBits(stream, (Uint32)(dy + (1 << (NET_SMALL_DELTA_BITS - 1))), NET_SMALL_DELTA_BITS);
+    } else if (spread < 1 << (NET_MEDIUM_DELTA_BITS - 1)) {
+        writeBits(stream, 2, 2);
+        writeBits(stream, (Uint32)(dx + (1 << (NET_MEDIUM_DELTA_BITS - 1))), NET_MEDIUM_DELTA_BITS);
+        writeBits(stream, (Uint32)(dy + (1 << (NET_MEDIUM_DELTA_BITS - 1))), NET_MEDIUM_DELTA_BITS);
+    } else {
+        writeBits(stream, 3, 2);
+        writeBits(stream, x, 16);
+        writeBits(stream, y, 16);
+    }
+}
+
+void readEntity(BitStream* stream, Uint16* x, Uint16* y, Uint16 baseX, Uint16 baseY) {
+    int bits = 0;
+    switch (readBits(stream, 2)) {
+    case 0:
+        *x = baseX;
+        *y = baseY;
+        return;
+    case 1:
+        bits = NET_SMALL_DELTA_BITS;
+        break;
+    case 2:
+        bits = NET_MEDIUM_DELTA_BITS;
+        break;
+    default:
+        *x = (Uint16)readBits(stream, 16);
+        *y = (Uint16)readBits(stream, 16);
+        return;
+    }
+    *x = (Uint16)(baseX + (int)readBits(stream, bits) - (1 << (bits - 1)));
+    *y = (Uint16)(baseY + (int)readBits(stream, bits) - (1 << (bits - 1)));
+}
+
+// Writes entities from *cursor on, wrapping around, until endBit would be
+// crossed, and records them in the view's group. Slots at or past baseCount
+// are new to the baseline and coded against 0.
+void writeEntityGroup(BitStream* stream, int endBit, NetGroup* group, int baseCount,
+    const float* x, const float* y, int count, int* cursor) {
+    if (count > NET_MAX_ENTITIES) count = NET_MAX_ENTITIES;  // runServer refuses sessions that reach this
+    int start = *cursor < count ? *cursor : 0;
+    writeBits(stream, (Uint32)count, 16);
+    writeBits(stream, (Uint32)start, 16);
+    int sentAt = stream->bit;
+    writeBits(stream, 0, 16);
+
+    int sent = 0;
+    for (int slot = start; sent < count && stream->bit + NET_ENTITY_MAX_BITS <= endBit; sent++) {
+        Uint16 qx = quantizePosition(x[slot]);
+        Uint16 qy = quantizePosition(y[slot]);
+        bool known = slot < baseCount;
+        writeEntity(stream, qx, qy, known ? group->x[slot] : 0, known ? group->y[slot] : 0);
+        group->x[slot] = qx;
+        group->y[slot] = qy;
+        if (++slot == count) slot = 0;
+    }
+    patchBits(stream, sentAt, (Uint32)sent, 16);
+    group->count = count;
+    *cursor = sent == count ? 0 : (start + sent) % count;
+}
+
+bool readEntityGroup(BitStream* stream, NetGroup* group, int baseCount, int* start, int* sent) {
+    int count = (int)readBits(stream, 16);
+    *start = (int)readBits(stream, 16);
+    *sent = (int)readBits(stream, 16);
+    if (stream->overflow || count > NET_MAX_ENTITIES || *sent > count || (count > 0 && *start >= count)) {
+        return false;
+    }
+    for (int k = 0, slot = *start; k < *sent; k++) {
+        bool known = slot < baseCount;
+        readEntity(stream, &group->x[slot], &group->y[slot], known ? group->x[slot] : 0, known ? group->y[slot] : 0);
+        if (++slot == count) slot = 0;
+    }
+    group->count = count;
+    return !stream->overflow;
+}
+
+bool openNetLink(NetLink* link, int port) {
+    *link = (NetLink){ .socket = INVALID_SOCKET, .rng = { options.seed ^ 0xD1B54A32D192ED03ull ^ (Uint64)port } };
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        fprintf(stderr, "Could not start Winsock\n");
+        return false;
+    }
+#endif
+    link->socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    struct sockaddr_in address = { 0 };
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((Uint16)port);
+    if (link->socket == INVALID_SOCKET || bind(link->socket, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Could not open UDP port %d\n", port);
+        if (link->socket != INVALID_SOCKET) closesocket(link->socket);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return false;
+    }
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+    ioctlsocket(link->socket, FIONBIO, &nonBlocking);
+#else
+    fcntl(link->socket, F_SETFL, fcntl(link->socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    link->delayed = SDL_malloc(NET_DELAY_QUEUE * sizeof(DelayedPacket));
+    return true;
+}
+
+void closeNetLink(NetLink* link) {
+    closesocket(link->socket);
+    SDL_free(link->delayed);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+// "HOST:PORT" with HOST a name or an IPv4 address.
+bool resolveAddress(const char* text, struct sockaddr_in* address) {
+    char host[256];
+    const char* colon = strrchr(text, ':');
+    if (!colon || colon == text || (size_t)(colon - text) >= sizeof(host)) {
+        return false;
     }
+    memcpy(host, text, colon - text);
+    host[colon - text] = '\0';
 
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    //switch to software rendering
-    if (!renderer) {
-        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+    struct addrinfo hints = { 0 };
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo* result;
+    if (getaddrinfo(host, colon + 1, &hints, &result) != 0) {
+        return false;
     }
+    memcpy(address, result->ai_addr, sizeof(*address));
+    freeaddrinfo(result);
+    return true;
+}
 
-    menuBackgroundTexture = IMG_LoadTexture(renderer, "./assets/images/mmbg.png");
-    backgroundTexture = IMG_LoadTexture(renderer, "./assets/images/bg.png");
-    playerTexture = IMG_LoadTexture(renderer, "./assets/images/player.png");
-    enemyTexture = IMG_LoadTexture(renderer, "./assets/images/enemy.png");
-    redDotTexture = IMG_LoadTexture(renderer, "./assets/images/fireball.png");
-    font = TTF_OpenFont("./assets/fonts/VCR_OSD_MONO.ttf",24);
-    gameOverFont = TTF_OpenFont("./assets/fonts/VCR_OSD_MONO.ttf",100);
-    
-    srand(time(NULL));
+bool sameAddress(const struct sockaddr_in* a, const struct sockaddr_in* b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
 }
 
-void cleanup() {
-    SDL_DestroyTexture(backgroundTexture);
-    SDL_DestroyTexture(menuBackgroundTexture);
-    SDL_DestroyTexture(playerTexture);
-    SDL_DestroyTexture(enemyTexture);
-    TTF_CloseFont(font);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    IMG_Quit();
-    TTF_Quit();
-    SDL_Quit();
+void formatAddress(char* out, size_t size, const struct sockaddr_in* address) {
+    const Uint8* ip = (const Uint8*)&address->sin_addr.s_addr;
+    SDL_snprintf(out, size, "%d.%d.%d.%d:%d", ip[0], ip[1], ip[2], ip[3], ntohs(address->sin_port));
 }
 
-void renderBackground() {
-    SDL_RenderCopy(renderer, backgroundTexture, NULL, NULL);
+void sendNow(NetLink* link, const struct sockaddr_in* to, const Uint8* data, int length) {
+    sendto(link->socket, (const char*)data, length, 0, (const struct sockaddr*)to, sizeof(*to));
 }
 
-void renderHPBar(Entity* player) {
-    int barWidth = 200;  
-    int barHeight = 20;  
+// Counts the packet as sent, then drops it with probability netLoss or holds
+// it back for netLatency plus up to netJitter ms. Jitter reorders packets
+// the way a real network does.
+void sendPacket(NetLink* link, const struct sockaddr_in* to, const Uint8* data, int length) {
+    link->packetsSent++;
+    link->bytesSent += length;
+    if (options.netLoss > 0 && rngNext(&link->rng) % 10000 < options.netLoss * 100) {
+        link->packetsDropped++;
+        return;
+    }
+    Uint32 delay = options.netLatency + (options.netJitter > 0 ? rngNext(&link->rng) % (options.netJitter + 1) : 0);
+    if (delay == 0) {
+        sendNow(link, to, data, length);
+        return;
+    }
+    if (link->delayedCount == NET_DELAY_QUEUE) {
+        link->packetsDropped++;  // like a router with a full buffer
+        return;
+    }
+    DelayedPacket* packet = &link->delayed[link->delayedCount++];
+    packet->deliverAt = SDL_GetTicks() + delay;
+    packet->to = *to;
+    packet->length = length;
+    memcpy(packet->data, data, length);
+}
 
-    int x = (SCREEN_WIDTH - barWidth) / 2; 
-    int y = SCREEN_HEIGHT - barHeight - 10;
+// Sends the held back packets that are due, keeping the rest in order.
+void flushNetLink(NetLink* link) {
+    Uint32 now = SDL_GetTicks();
+    int kept = 0;
+    for (int i = 0; i < link->delayedCount; i++) {
+        DelayedPacket* packet = &link->delayed[i];
+        if ((Sint32)(now - packet->deliverAt) >= 0) {
+            sendNow(link, &packet->to, packet->data, packet->length);
+        } else if (kept++ != i) {
+            link->delayed[kept - 1] = *packet;
+        }
+    }
+    link->delayedCount = kept;
+}
 
-    float hpPercentage = (float)player->hp / PLAYER_MAX_HP;
-    int currentBarWidth = (int)(barWidth * hpPercentage);
+int receivePacket(NetLink* link, Uint8* data, struct sockaddr_in* from) {
+    socklen_t size = sizeof(*from);
+    int length = (int)recvfrom(link->socket, (char*)data, NET_MAX_PACKET, 0, (struct sockaddr*)from, &size);
+    if (length > 0) {
+        link->packetsReceived++;
+        link->bytesReceived += length;
+    }
+    return length;
+}
 
-    SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);  // Gray 
-    SDL_Rect backgroundRect = { x, y, barWidth, barHeight };
-    SDL_RenderFillRect(renderer, &backgroundRect);
+// Builds this tick's view from the baseline and writes the difference.
+// Bullets may use up to half of the room left after the player, enemies get
+// the rest; whatever does not fit is sent in the following snapshots.
+int encodeSnapshot(NetServer* server, const World* world, Uint8* packet) {
+    Uint32 tick = server->tick;
+    NetView* view = &server->views[tick & (NET_VIEW_HISTORY - 1)];
+    const NetView* base = &server->views[server->ackedTick & (NET_VIEW_HISTORY - 1)];
+    if (server->ackedTick == 0 || tick - server->ackedTick >= NET_VIEW_HISTORY || base->tick != server->ackedTick) {
+        base = NULL;
+    }
+    if (base) {
+        *view = *base;
+    } else {
+        memset(view, 0, sizeof(NetView));
+    }
+    int baseCounts[NET_GROUP_COUNT] = { view->groups[NET_ENEMIES].count, view->groups[NET_BULLETS].count };
 
-    SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);  // Red 
-    SDL_Rect hpRect = { x, y, currentBarWidth, barHeight };
-    SDL_RenderFillRect(renderer, &hpRect);
-}
+    view->tick = tick;
+    view->lastInput = server->lastInput;
+    view->playerX = quantizePosition(world->player.x);
+    view->playerY = quantizePosition(world->player.y);
+    view->angle = quantizeAngle(world->angle);
+    view->hp = world->player.hp > 0 ? world->player.hp : 0;
+    view->score = score;
+    view->gameOver = gameOver;
 
+    packet[0] = PACKET_SNAPSHOT;
+    writeU32(packet + 1, tick);
+    writeU32(packet + 5, base ? base->tick : 0);
+    writeU32(packet + 9, view->lastInput);
+    BitStream stream = { packet + NET_SNAPSHOT_HEADER, (NET_MAX_PACKET - NET_SNAPSHOT_HEADER) * 8, 0, false };
+    writeBits(&stream, view->playerX, 16);
+    writeBits(&stream, view->playerY, 16);
+    writeBits(&stream, view->angle, NET_ANGLE_BITS);
+    writeBits(&stream, (Uint32)view->hp, 8);
+    writeBits(&stream, (Uint32)view->score, 32);
+    writeBits(&stream, view->gameOver, 1);
 
-void render(Entity* player, Entity enemies[], float redDotX, float redDotY) {
-    SDL_RenderClear(renderer);
-    renderBackground();
+    writeEntityGroup(&stream, stream.bit + (stream.size - stream.bit) / 2, &view->groups[NET_BULLETS],
+        baseCounts[NET_BULLETS], bullets.x, bullets.y, bullets.count, &server->cursors[NET_BULLETS]);
+    writeEntityGroup(&stream, stream.size, &view->groups[NET_ENEMIES], baseCounts[NET_ENEMIES],
+        world->enemies.x, world->enemies.y, world->enemies.count, &server->cursors[NET_ENEMIES]);
+    return NET_SNAPSHOT_HEADER + (stream.bit + 7) / 8;
+}
 
-    // Render player
-    SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
-    SDL_Rect playerRect = { (int)player->x, 
-    (int)player->y, PLAYER_SIZE, PLAYER_SIZE };
-    SDL_RenderCopy(renderer, playerTexture, 
-    NULL, &playerRect);
+// Inputs arrive newest first, each followed by the ones before it that are
+// not acknowledged yet, so a lost packet costs nothing while a later one gets through.
+void receiveInputs(NetServer* server, const Uint8* packet, int length) {
+    if (length < NET_INPUT_HEADER) {
+        return;
+    }
+    Uint32 ack = readU32(packet + 1);
+    Uint32 newest = readU32(packet + 5);
+    int count = packet[9];
+    if (ack > server->ackedTick && ack <= server->tick) {
+        server->ackedTick = ack;
+    }
+    if (newest >= server->nextInput + NET_INPUT_HISTORY) {
+        return;  // too far ahead to be a client we are in step with
+    }
 
-    // Render enemies
-    for (int i = 0; i < ENEMY_COUNT; i++) {
-        if (enemies[i].alive) {
-            SDL_Rect enemyRect = { (int)enemies[i].x, (int)enemies[i].y, enemies[i].size, enemies[i].size };
-            SDL_RenderCopy(renderer, enemyTexture, NULL, &enemyRect);
+    BitStream stream = { (Uint8*)packet + NET_INPUT_HEADER, (length - NET_INPUT_HEADER) * 8, 0, false };
+    for (int k = 0; k < count && (Uint32)k < newest; k++) {
+        Uint32 seq = newest - k;
+        SimInput input = { (Uint8)readBits(&stream, 4), readBits(&stream, 1) != 0, 0, 0 };
+        if (input.fire) {
+            input.fireX = dequantizePosition((Uint16)readBits(&stream, 16));
+            input.fireY = dequantizePosition((Uint16)readBits(&stream, 16));
+        }
+        if (stream.overflow) {
+            return;
+        }
+        if (seq >= server->nextInput) {
+            server->inputs[seq & (NET_INPUT_HISTORY - 1)] = (NetInput){ seq, input, 0, 0 };
         }
     }
- 
-    renderHPBar(player);
+    if (newest > server->newestInput) {
+        server->newestInput = newest;
+    }
+}
 
-    // Render revolving red dot
-    SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-    SDL_Rect redDotRect = { (int)redDotX - RED_DOT_RADIUS, (int)redDotY - RED_DOT_RADIUS, RED_DOT_RADIUS * 2, RED_DOT_RADIUS * 2 };
-    SDL_RenderCopy(renderer, redDotTexture, NULL, &redDotRect);
+void startServerGame(NetServer* server, World* world, const struct sockaddr_in* peer, Uint64 seed) {
+    NetLink link = server->link;
+    NetView* views = server->views;
+    memset(views, 0, NET_VIEW_HISTORY * sizeof(NetView));
+    *server = (NetServer){ .link = link, .views = views, .peer = *peer, .connected = true,
+        .lastHeard = SDL_GetTicks(), .nextInput = 1 };
+    initWorld(world, seed);
 
-    char scoretxt[30];
-    sprintf(scoretxt, "Score: %d", score);
+    char address[32];
+    formatAddress(address, sizeof(address), peer);
+    printf("%s joined\n", address);
+    fflush(stdout);
+}
 
-    SDL_Color color= {255, 255, 255, 255};
-    SDL_Surface* textSurface= TTF_RenderText_Solid(font, scoretxt, color);
-    SDL_Texture* textTexture= SDL_CreateTextureFromSurface(renderer, textSurface);
+void endServerGame(NetServer* server, const char* reason) {
+    char address[32];
+    formatAddress(address, sizeof(address), &server->peer);
+    double seconds = (double)server->tick / simTickRate;
+    printf("%s %s after %u ticks: score=%d snapshots=%u avg_snapshot_bytes=%.1f max_snapshot_bytes=%d kbytes_per_sec=%.2f\n",
+        address, reason, server->tick, score, server->snapshots,
+        server->snapshots ? (double)server->snapshotBytes / server->snapshots : 0.0, server->largestSnapshot,
+        seconds > 0 ? server->snapshotBytes / seconds / 1024 : 0.0);
+    fflush(stdout);
+    server->connected = false;
+}
 
-    SDL_Rect textRect= {10,20, textSurface->w, textSurface->h};
-    SDL_RenderCopy(renderer, textTexture, NULL, &textRect);
+// Applies the client's next input, or repeats its last move when that input
+// is late, then answers with a snapshot.
+void serverTick(NetServer* server, World* world, Uint8* packet) {
+    if (server->newestInput >= server->nextInput + NET_INPUT_BACKLOG) {
+        // a burst arrived after a stall; catching up on stale inputs would only add latency
+        server->nextInput = server->newestInput - NET_INPUT_BACKLOG / 2;
+    }
+    SimInput input = { server->lastMove, false, 0, 0 };
+    const NetInput* next = &server->inputs[server->nextInput & (NET_INPUT_HISTORY - 1)];
+    if (next->seq == server->nextInput) {
+        input = next->input;
+        server->lastMove = input.move;
+        server->lastInput = server->nextInput++;
+    }
+    if (!gameOver) {
+        simStep(world, &input);
+    }
 
-    SDL_FreeSurface(textSurface);
-    SDL_DestroyTexture(textTexture);
+    server->tick++;
+    int length = encodeSnapshot(server, world, packet);
+    sendPacket(&server->link, &server->peer, packet, length);
+    server->snapshots++;
+    server->snapshotBytes += length;
+    if (length > server->largestSnapshot) server->largestSnapshot = length;
+}
 
-    
-    int highScore = loadHighScore();
+// Hosts one remote player at a time, without a window, for --ticks ticks.
+int runServer() {
+    // Snapshots cannot page past NET_MAX_ENTITIES, so larger sessions would hide enemies from clients
+    if (largestWave() > NET_MAX_ENTITIES || options.bulletLimit > NET_MAX_ENTITIES) {
+        fprintf(stderr, "Cannot serve waves of %d enemies with %d bullets: clients can be sent at most %d of each\n",
+            largestWave(), options.bulletLimit, NET_MAX_ENTITIES);
+        return 1;
+    }
+    NetServer server = { 0 };
+    if (!openNetLink(&server.link, options.serverPort)) {
+        return 1;
+    }
+    server.views = SDL_calloc(NET_VIEW_HISTORY, sizeof(NetView));
+    Rng sessionRng = { options.seed };
+    World world = { 0 };
+    initProfiler(options.tracePath != NULL);
+    printf("Listening on UDP port %d\n", options.serverPort);
+    fflush(stdout);
 
-    char highScoreText[50];
-    sprintf(highScoreText, "High Score: %d", highScore);
-    SDL_Surface* highScoreSurface = TTF_RenderText_Solid(font, highScoreText, (SDL_Color){255, 255, 255, 255});
-    SDL_Texture* highScoreTexture = SDL_CreateTextureFromSurface(renderer, highScoreSurface);
-        
-    SDL_Rect highScoreRect = {10, 70, highScoreSurface->w, highScoreSurface->h};
-    SDL_RenderCopy(renderer, highScoreTexture, NULL, &highScoreRect);
+    Uint8 packet[NET_MAX_PACKET];
+    Uint64 lastCounter = SDL_GetPerformanceCounter();
+    double accumulator = 0;
+    Uint64 elapsed = 0;
+    while (elapsed < options.ticks) {
+        struct sockaddr_in from;
+        int length;
+        while ((length = receivePacket(&server.link, packet, &from)) > 0) {
+            bool fromPlayer = server.connected && sameAddress(&from, &server.peer);
+            if (fromPlayer) {
+                server.lastHeard = SDL_GetTicks();
+                if (packet[0] == PACKET_INPUT) {
+                    receiveInputs(&server, packet, length);
+                } else if (packet[0] == PACKET_DISCONNECT) {
+                    endServerGame(&server, "left");
+                }
+            } else if (!server.connected && packet[0] == PACKET_CONNECT) {
+                if (length < NET_CONNECT_SIZE || readU32(packet + 1) != NET_PROTOCOL_VERSION ||
+                    readU32(packet + 5) != (Uint32)simTickRate) {
+                    fprintf(stderr, "Ignored a client with another protocol version or tick rate\n");
+                    continue;
+                }
+                startServerGame(&server, &world, &from, rngNext(&sessionRng));
+            }
+        }
+        if (server.connected && SDL_GetTicks() - server.lastHeard > NET_TIMEOUT_MS) {
+            endServerGame(&server, "timed out");
+        }
 
-    SDL_FreeSurface(highScoreSurface);
-    SDL_DestroyTexture(highScoreTexture);
-    renderBullets();
+        Uint64 now = SDL_GetPerformanceCounter();
+        double frameTime = (double)(now - lastCounter) / SDL_GetPerformanceFrequency();
+        lastCounter = now;
+        accumulator += frameTime < MAX_FRAME_TIME ? frameTime : MAX_FRAME_TIME;
+        while (accumulator >= simDt && elapsed < options.ticks) {
+            if (server.connected) {
+                serverTick(&server, &world, packet);
+                profiler.frame++;
+            }
+            accumulator -= simDt;
+            elapsed++;
+        }
+        flushNetLink(&server.link);
+        SDL_Delay(1);
+    }
 
-    SDL_RenderPresent(renderer);
+    if (server.connected) {
+        endServerGame(&server, "was dropped");
+    }
+    freeEnemies(&world.enemies);
+    freeBullets(&bullets);
+    SDL_free(server.views);
+    closeNetLink(&server.link);
+    shutdownProfiler();
+    return 0;
 }
 
-void renderGameOverText() {
-    const char* gameOverText = "Game Over";
-    SDL_Color color = { 255, 0, 0, 255 };
-    
-    SDL_Surface* textSurface = TTF_RenderText_Solid(gameOverFont, gameOverText, color);
-    SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
-
-    SDL_Rect textRect;
-    textRect.x = (SCREEN_WIDTH - textSurface->w) / 2;
-    textRect.y = (SCREEN_HEIGHT - textSurface->h) / 2;
-    textRect.w = textSurface->w;
-    textRect.h = textSurface->h;
-
-    SDL_RenderCopy(renderer, textTexture, NULL, &textRect);
+// Restarts prediction from the server's position and replays the inputs it
+// has not applied yet. An earlier prediction that was off counts as a correction.
+void reconcilePlayer(NetClient* client, const NetView* view) {
+    float serverX = dequantizePosition(view->playerX);
+    float serverY = dequantizePosition(view->playerY);
+    const NetInput* applied = &client->inputs[view->lastInput & (NET_INPUT_HISTORY - 1)];
+    if (view->lastInput != 0 && applied->seq == view->lastInput) {
+        float error = hypotf(applied->predictedX - serverX, applied->predictedY - serverY);
+        client->reconciliations++;
+        if (error > NET_CORRECTION_EPSILON) {
+            client->corrections++;
+            if (error > client->largestCorrection) client->largestCorrection = error;
+        }
+    }
 
-    SDL_FreeSurface(textSurface);
-    SDL_DestroyTexture(textTexture);
+    client->appliedInput = view->lastInput;
+    client->player.x = serverX;
+    client->player.y = serverY;
+    client->player.hp = view->hp;
+    client->angle = dequantizeAngle(view->angle);
+    for (Uint32 seq = view->lastInput + 1; seq <= client->inputSeq; seq++) {
+        NetInput* input = &client->inputs[seq & (NET_INPUT_HISTORY - 1)];
+        if (input->seq != seq) {
+            continue;
+        }
+        movePlayer(&client->player, input->input.move);
+        input->predictedX = client->player.x;
+        input->predictedY = client->player.y;
+        client->angle = sweepAngle(client->angle);
+    }
 }
 
-void saveHighScore(int score) {
-    FILE* file = fopen("highscore.dat", "wb");
-    if (file) {
-        fwrite(&score, sizeof(int), 1, file);
-        fclose(file);
+bool decodeSnapshot(NetClient* client, const Uint8* packet, int length) {
+    if (length < NET_SNAPSHOT_HEADER) {
+        return false;
     }
-}
+    Uint32 tick = readU32(packet + 1);
+    Uint32 baseline = readU32(packet + 5);
+    NetView* slot = &client->views[tick & (NET_VIEW_HISTORY - 1)];
+    if (tick == 0 || slot->tick == tick || tick + NET_VIEW_HISTORY <= client->newestTick) {
+        return false;  // a duplicate, or too old to keep
+    }
+    NetView* view = client->scratch;
+    if (baseline == 0) {
+        memset(view, 0, sizeof(NetView));
+    } else {
+        const NetView* base = &client->views[baseline & (NET_VIEW_HISTORY - 1)];
+        if (base->tick != baseline || tick - baseline >= NET_VIEW_HISTORY) {
+            return false;  // the baseline is already gone
+        }
+        *view = *base;
+    }
+    int baseCounts[NET_GROUP_COUNT] = { view->groups[NET_ENEMIES].count, view->groups[NET_BULLETS].count };
 
-int loadHighScore() {
-    FILE* file = fopen("highscore.dat", "rb");
-    int highScore = 0;
-    if (file) {
-        fread(&highScore, sizeof(int), 1, file);
-        fclose(file);
+    view->tick = tick;
+    view->lastInput = readU32(packet + 9);
+    BitStream stream = { (Uint8*)packet + NET_SNAPSHOT_HEADER, (length - NET_SNAPSHOT_HEADER) * 8, 0, false };
+    view->playerX = (Uint16)readBits(&stream, 16);
+    view->playerY = (Uint16)readBits(&stream, 16);
+    view->angle = (Uint16)readBits(&stream, NET_ANGLE_BITS);
+    view->hp = (int)readBits(&stream, 8);
+    view->score = (int)readBits(&stream, 32);
+    view->gameOver = readBits(&stream, 1) != 0;
+    int start[NET_GROUP_COUNT], sent[NET_GROUP_COUNT];
+    if (!readEntityGroup(&stream, &view->groups[NET_BULLETS], baseCounts[NET_BULLETS], &start[NET_BULLETS], &sent[NET_BULLETS]) ||
+        !readEntityGroup(&stream, &view->groups[NET_ENEMIES], baseCounts[NET_ENEMIES], &start[NET_ENEMIES], &sent[NET_ENEMIES])) {
+        return false;
     }
-    return highScore;
-}
+    *slot = *view;
+    client->snapshots++;
+    client->snapshotBytes += length;
+    if (client->firstTick == 0) client->firstTick = tick;
 
-void renderRoundedRect(SDL_Renderer* renderer, SDL_Rect rect, int radius) {
-    // top-left corner arc
-    for (int y = 0; y < radius; y++) {
-        for (int x = 0; x < radius; x++) {
-            if (x * x + y * y <= radius * radius) {
-                SDL_RenderDrawPoint(renderer, rect.x + x, rect.y + y); // Top-left
-                SDL_RenderDrawPoint(renderer, rect.x + rect.w - x - 1, rect.y + y); // Top-right 
-                SDL_RenderDrawPoint(renderer, rect.x + x, rect.y + rect.h - y - 1); // Bottom-left 
-                SDL_RenderDrawPoint(renderer, rect.x + rect.w - x - 1, rect.y + rect.h - y - 1); // Bottom-right 
+    // A late snapshot still updates whatever it has newer positions for
+    for (int g = 0; g < NET_GROUP_COUNT; g++) {
+        const NetGroup* group = &slot->groups[g];
+        for (int k = 0, i = start[g]; k < sent[g]; k++) {
+            if (tick > client->shownTick[g][i]) {
+                client->shown[g].x[i] = group->x[i];
+                client->shown[g].y[i] = group->y[i];
+                client->shownTick[g][i] = tick;
             }
+            if (++i == group->count) i = 0;
         }
     }
-
-    // top and bottom horizontal borders
-    for (int x = radius; x < rect.w - radius; x++) {
-        SDL_RenderDrawPoint(renderer, rect.x + x, rect.y); // Top border
-        SDL_RenderDrawPoint(renderer, rect.x + x, rect.y + rect.h - 1); // Bottom border
+    if (tick > client->newestTick) {
+        client->newestTick = tick;
+        client->shown[NET_ENEMIES].count = slot->groups[NET_ENEMIES].count;
+        client->shown[NET_BULLETS].count = slot->groups[NET_BULLETS].count;
+        client->score = slot->score;
+        client->gameOver = slot->gameOver;
+        reconcilePlayer(client, slot);
     }
+    return true;
+}
 
-    // left and right vertical borders
-    for (int y = radius; y < rect.h - radius; y++) {
-        SDL_RenderDrawPoint(renderer, rect.x, rect.y + y); // Left border
-        SDL_RenderDrawPoint(renderer, rect.x + rect.w - 1, rect.y + y); // Right border
+void freeNetClient(NetClient* client) {
+    SDL_free(client->views);
+    SDL_free(client->scratch);
+    SDL_free(client);
+}
+
+NetClient* startNetClient() {
+    NetClient* client = SDL_calloc(1, sizeof(NetClient));
+    client->views = SDL_calloc(NET_VIEW_HISTORY, sizeof(NetView));
+    client->scratch = SDL_malloc(sizeof(NetView));
+    if (!openNetLink(&client->link, 0)) {
+        freeNetClient(client);
+        return NULL;
     }
+    if (!resolveAddress(options.connectAddress, &client->server)) {
+        fprintf(stderr, "Could not resolve %s\n", options.connectAddress);
+        closeNetLink(&client->link);
+        freeNetClient(client);
+        return NULL;
+    }
+    client->lastConnect = SDL_GetTicks() - NET_CONNECT_RETRY_MS;
+    client->player = (Entity){ WORLD_WIDTH / 2, WORLD_HEIGHT / 2, PLAYER_SIZE, true, PLAYER_MAX_HP };
+    return client;
+}
 
-    // vertical sides of the arcs
-    for (int y = 0; y < radius; y++) {
-        for (int x = 0; x < radius; x++) {
-            if (x * x + y * y <= radius * radius) {
-                SDL_RenderDrawPoint(renderer, rect.x + x, rect.y + rect.h - y - 1); // Bottom-left corner
-                SDL_RenderDrawPoint(renderer, rect.x + rect.w - x - 1, rect.y + rect.h - y - 1); // Bottom-right corner
-            }
+// Reads every pending packet, and keeps asking to join until the first snapshot arrives.
+void pumpNetClient(NetClient* client) {
+    Uint8 packet[NET_MAX_PACKET];
+    struct sockaddr_in from;
+    int length;
+    while ((length = receivePacket(&client->link, packet, &from)) > 0) {
+        if (sameAddress(&from, &client->server) && packet[0] == PACKET_SNAPSHOT && decodeSnapshot(client, packet, length)) {
+            client->connected = true;
         }
     }
+    if (!client->connected && SDL_GetTicks() - client->lastConnect >= NET_CONNECT_RETRY_MS) {
+        packet[0] = PACKET_CONNECT;
+        writeU32(packet + 1, NET_PROTOCOL_VERSION);
+        writeU32(packet + 5, (Uint32)simTickRate);
+        sendPacket(&client->link, &client->server, packet, NET_CONNECT_SIZE);
+        client->lastConnect = SDL_GetTicks();
+    }
+    flushNetLink(&client->link);
 }
 
-void renderButton(SDL_Rect button, const char* label) {
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255); // White
-    renderRoundedRect(renderer, button, 10); 
+// Predicts the tick locally and sends its input along with the ones the
+// server has not confirmed yet.
+void tickNetClient(NetClient* client, const SimInput* input) {
+    Uint32 seq = ++client->inputSeq;
+    NetInput* slot = &client->inputs[seq & (NET_INPUT_HISTORY - 1)];
+    movePlayer(&client->player, input->move);
+    client->angle = sweepAngle(client->angle);
+    *slot = (NetInput){ seq, *input, client->player.x, client->player.y };
 
-    SDL_Color color = { 255, 255, 255, 255 };
-    SDL_Surface* textSurface = TTF_RenderText_Solid(font, label, color);
-    SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
-    SDL_Rect textRect;
-    textRect.x = button.x + (button.w - textSurface->w) / 2;
-    textRect.y = button.y + (button.h - textSurface->h) / 2;
-    textRect.w = textSurface->w;
-    textRect.h = textSurface->h;
+    Uint8 packet[NET_MAX_PACKET];
+    Uint32 unconfirmed = seq - client->appliedInput;
+    int count = unconfirmed < NET_INPUT_REDUNDANCY ? (int)unconfirmed : NET_INPUT_REDUNDANCY;
+    packet[0] = PACKET_INPUT;
+    writeU32(packet + 1, client->newestTick);
+    writeU32(packet + 5, seq);
+    packet[9] = (Uint8)count;
+    BitStream stream = { packet + NET_INPUT_HEADER, (NET_MAX_PACKET - NET_INPUT_HEADER) * 8, 0, false };
+    for (int k = 0; k < count; k++) {
+        const NetInput* sent = &client->inputs[(seq - k) & (NET_INPUT_HISTORY - 1)];
+        SimInput copy = sent->seq == seq - k ? sent->input : (SimInput){ 0 };
+        writeBits(&stream, copy.move, 4);
+        writeBits(&stream, copy.fire, 1);
+        if (copy.fire) {
+            writeBits(&stream, quantizePosition(copy.fireX), 16);
+            writeBits(&stream, quantizePosition(copy.fireY), 16);
+        }
+    }
+    sendPacket(&client->link, &client->server, packet, NET_INPUT_HEADER + (stream.bit + 7) / 8);
+}
 
-    SDL_RenderCopy(renderer, textTexture, NULL, &textRect);
-    SDL_FreeSurface(textSurface);
-    SDL_DestroyTexture(textTexture);
+void printNetStats(const NetClient* client, double seconds) {
+    Uint32 expected = client->newestTick >= client->firstTick && client->firstTick ? client->newestTick - client->firstTick + 1 : 0;
+    printf("ticks=%u snapshots=%u lost=%u avg_snapshot_bytes=%.1f down_kbytes_per_sec=%.2f up_kbytes_per_sec=%.2f "
+        "dropped_by_simulator=%u corrections=%u/%u correction_rate=%.2f%% largest_correction=%.2f\n",
+        client->inputSeq, client->snapshots, expected > client->snapshots ? expected - client->snapshots : 0,
+        client->snapshots ? (double)client->snapshotBytes / client->snapshots : 0.0,
+        seconds > 0 ? client->link.bytesReceived / seconds / 1024 : 0.0,
+        seconds > 0 ? client->link.bytesSent / seconds / 1024 : 0.0,
+        client->link.packetsDropped, client->corrections, client->reconciliations,
+        client->reconciliations ? 100.0 * client->corrections / client->reconciliations : 0.0,
+        client->largestCorrection);
 }
 
+void stopNetClient(NetClient* client, double seconds) {
+    if (client->connected) {
+        Uint8 packet = PACKET_DISCONNECT;
+        sendNow(&client->link, &client->server, &packet, 1);
+    }
+    if (options.headless || options.showStats) {
+        printNetStats(client, seconds);
+    }
+    closeNetLink(&client->link);
+    freeNetClient(client);
+}
 
-void updateButtonPositions(SDL_Rect* startButton, SDL_Rect* optionButton) {
-    int buttonWidth = SCREEN_WIDTH / 4;
-    int buttonHeight = SCREEN_HEIGHT / 10;
-    
-    *startButton = (SDL_Rect){
-        .x = SCREEN_WIDTH / 2 - buttonWidth / 2,
-        .y = SCREEN_HEIGHT / 2 - buttonHeight / 2, // -10 instead of /2
-        .w = buttonWidth,
-        .h = buttonHeight
-    };
-    
-    // *optionButton = (SDL_Rect){
-    //     .x = SCREEN_WIDTH / 2 - buttonWidth / 2,
-    //     .y = SCREEN_HEIGHT / 2 + 10,
-    //     .w = buttonWidth,
-    //     .h = buttonHeight
-    // };
+// The headless bot, playing from what the client sees.
+void netBotInput(const NetClient* client, Rng* rng, SimInput* input) {
+    Uint32 tick = client->inputSeq;
+    if (tick % 30 == 0) {
+        input->move = (Uint8)(rngNext(rng) & (INPUT_UP | INPUT_DOWN | INPUT_LEFT | INPUT_RIGHT));
+    }
+    input->fire = false;
+    const NetGroup* enemies = &client->shown[NET_ENEMIES];
+    if (tick % 15 == 0 && enemies->count > 0) {
+        input->fire = true;
+        input->fireX = dequantizePosition(enemies->x[0]) + ENEMY_SIZE / 2;
+        input->fireY = dequantizePosition(enemies->y[0]) + ENEMY_SIZE / 2;
+    }
 }
 
-bool allEnemiesDefeated(Entity enemies[]) {
-    for (int i = 0; i < ENEMY_COUNT; i++) {
-        if (enemies[i].alive) {
-            return false;
+// Plays --ticks ticks on a server with the scripted player and prints what
+// the connection cost.
+int runNetClient() {
+    NetClient* client = startNetClient();
+    if (!client) {
+        return 1;
+    }
+    Rng botRng = { options.seed ^ 0x9E3779B97F4A7C15ull };
+    SimInput input = { 0 };
+    Uint32 connectStart = SDL_GetTicks();
+    Uint64 startCounter = SDL_GetPerformanceCounter();
+    Uint64 lastCounter = startCounter;
+    double accumulator = 0;
+    int status = 0;
+    while (client->inputSeq < options.ticks && !client->gameOver) {
+        pumpNetClient(client);
+        if (!client->connected && SDL_GetTicks() - connectStart > NET_TIMEOUT_MS) {
+            fprintf(stderr, "No answer from %s\n", options.connectAddress);
+            status = 1;
+            break;
+        }
+
+        Uint64 now = SDL_GetPerformanceCounter();
+        double frameTime = (double)(now - lastCounter) / SDL_GetPerformanceFrequency();
+        lastCounter = now;
+        accumulator = client->connected ? accumulator + (frameTime < MAX_FRAME_TIME ? frameTime : MAX_FRAME_TIME) : 0;
+        while (accumulator >= simDt && client->inputSeq < options.ticks) {
+            netBotInput(client, &botRng, &input);
+            tickNetClient(client, &input);
+            accumulator -= simDt;
         }
+        flushNetLink(&client->link);
+        SDL_Delay(1);
     }
-    return true;
+    stopNetClient(client, (double)(SDL_GetPerformanceCounter() - startCounter) / SDL_GetPerformanceFrequency());
+    return status;
 }
 
-void updateEnemyPositions(Entity enemies[], 
-Entity* player, float deltaTime) {
-    for (int i = 0; i < ENEMY_COUNT; i++) {
-        if (enemies[i].alive) {
-            float dx = player->x - enemies[i].x;
-            float dy = player->y - enemies[i].y;
-            float distance = sqrt(dx * dx + dy * dy);
-            if (distance != 0) {
-                dx /= distance;
-                dy /= distance;
-            }
-            enemies[i].x += dx * ENEMY_SPEED * deltaTime;
-            enemies[i].y += dy * ENEMY_SPEED * deltaTime;
+// Consumes the frame's worth of ticks banked in the accumulator, then
+// copies the result into the back snapshot.
+void runSimFrame(SimPipeline* pipeline) {
+    PROFILE_BEGIN(ZONE_SIMULATION);
+    InputStamps* taken = &pipeline->snapshots[1 - pipeline->front].inputs;
+    taken->count = 0;
+    while (pipeline->accumulator >= simDt && !gameOver) {
+        SimInput input = { pipeline->move, false, 0, 0 };
+        if (pipeline->queuedShots > 0) {
+            input = pipeline->shots[0];
+            input.move = pipeline->move;
+            addInputStamp(taken, pipeline->shotStamps[0]);
+            --pipeline->queuedShots;
+            memmove(pipeline->shots, pipeline->shots + 1, pipeline->queuedShots * sizeof(SimInput));
+            memmove(pipeline->shotStamps, pipeline->shotStamps + 1, pipeline->queuedShots * sizeof(Uint64));
+        }
+        for (int i = 0; i < pipeline->moveStamps.count; i++) {
+            addInputStamp(taken, pipeline->moveStamps.times[i]);
         }
+        pipeline->moveStamps.count = 0;
+        if (pipeline->replaying && !replayNextInput(&replay, &input)) {
+            pipeline->accumulator = 0;
+            break;
+        }
+        recordInput(&recorder, &input);
+        simStep(pipeline->world, &input);
+        pipeline->accumulator -= simDt;
+        pipeline->endedGame = gameOver;
     }
+    captureSnapshot(&pipeline->snapshots[1 - pipeline->front], pipeline->world);
+    pipeline->world->kills.count = 0;  // each kill is drawn by exactly one frame
+    pipeline->world->volleys = 0;
+    PROFILE_END(ZONE_SIMULATION);
 }
 
-void fullScreen(SDL_Event *e){
-    if(e->key.keysym.sym == SDLK_f){
-        isFullScreen = !isFullScreen;
-        if (isFullScreen) {
-            SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN_DESKTOP);
-        } else {
-            SDL_SetWindowFullscreen(window, 0);
-            SDL_SetWindowSize(window, INITIAL_SCREEN_WIDTH, INITIAL_SCREEN_HEIGHT);
-        }        
+int simThread(void* data) {
+    SimPipeline* pipeline = data;
+    profiler.simThread = SDL_ThreadID();
+    while (true) {
+        SDL_SemWait(pipeline->start);
+        if (pipeline->quit) {
+            break;
+        }
+        runSimFrame(pipeline);
+        SDL_SemPost(pipeline->done);
     }
+    return 0;
 }
 
-void quitGame(SDL_Event *e){
-    if (e->type == SDL_QUIT) {
-        quit = true;
-        menuRunning = false;
-        running = false;
+// Only worth a thread of its own when there is more than one core to use.
+void initSimPipeline(SimPipeline* pipeline, World* world) {
+    *pipeline = (SimPipeline){ .world = world };
+    reserveSnapshot(&pipeline->snapshots[0], world->enemies.capacity, bullets.capacity);
+    reserveSnapshot(&pipeline->snapshots[1], world->enemies.capacity, bullets.capacity);
+    captureSnapshot(&pipeline->snapshots[0], world);
+    if (jobs.workerCount == 0) {
         return;
     }
+    pipeline->start = SDL_CreateSemaphore(0);
+    pipeline->done = SDL_CreateSemaphore(0);
+    if (pipeline->start && pipeline->done) {
+        pipeline->thread = SDL_CreateThread(simThread, "simulation", pipeline);
+    }
 }
 
-void gameRunning() {
-    Entity player = { SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, PLAYER_SIZE, true, PLAYER_MAX_HP };
-    Entity enemies[ENEMY_COUNT];
-    for (int i = 0; i < ENEMY_COUNT; i++) {
-        spawnEnemy(&enemies[i]);
+void kickSimFrame(SimPipeline* pipeline) {
+    pipeline->endedGame = false;
+    if (pipeline->thread) {
+        SDL_SemPost(pipeline->start);
+    } else {
+        runSimFrame(pipeline);
+        pipeline->front = 1 - pipeline->front;
     }
+}
 
-    Uint32 lastTime = SDL_GetTicks();
-    float angle = 0.0f;
-    gameOver = false;
+// Waits for the frame started by kickSimFrame() and makes it the one drawn next.
+void finishSimFrame(SimPipeline* pipeline) {
+    if (pipeline->thread) {
+        SDL_SemWait(pipeline->done);
+        pipeline->front = 1 - pipeline->front;
+    }
+}
+
+void shutdownSimPipeline(SimPipeline* pipeline) {
+    if (pipeline->thread) {
+        pipeline->quit = true;
+        SDL_SemPost(pipeline->start);
+        SDL_WaitThread(pipeline->thread, NULL);
+        profiler.simThread = 0;
+    }
+    if (pipeline->start) SDL_DestroySemaphore(pipeline->start);
+    if (pipeline->done) SDL_DestroySemaphore(pipeline->done);
+    freeSnapshot(&pipeline->snapshots[0]);
+    freeSnapshot(&pipeline->snapshots[1]);
+}
+
+void gameRunning(Rng* sessionRng) {
+    finishAssetLoading();
+    World world = { 0 };
+    initWorld(&world, nextGameSeed(sessionRng));
+    resetParticles(&particles);
+    SimPipeline pipeline;
+    initSimPipeline(&pipeline, &world);
+    pipeline.replaying = replay.playing;
+    inputLatency.presenting.count = 0;
+    inputLatency.lateStamped = 0;
+    reserveBatch(&spriteBatch, world.enemies.capacity + bullets.capacity + 4);  // plus player, HP bar and red dot
+    allocCheckWarmup();
 
-    Uint32 lastDamageTime = 0;
-    const Uint32 damageCooldown = 500;  
+    Uint64 lastCounter = SDL_GetPerformanceCounter();
+    Uint32 statsTime = SDL_GetTicks();
+    int statsFrames = 0;
+    bool redraw = true;
 
     while (running) {
+        PROFILE_BEGIN(ZONE_FRAME);
+        PROFILE_BEGIN(ZONE_EVENTS);
         SDL_Event e;
         while (SDL_PollEvent(&e)) {
             quitGame(&e);
             if (e.type == SDL_KEYDOWN) {
                 fullScreen(&e);
+                if (e.key.keysym.sym == SDLK_F3) {
+                    profiler.overlayVisible = !profiler.overlayVisible;
+                    redraw = true;
+                }
             } else if (e.type == SDL_WINDOWEVENT) {
                 if (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
-                    int width, height;
-                    SDL_GetWindowSize(window, &width, &height);
-
-                    float scaleX = (float)width / SCREEN_WIDTH;
-                    float scaleY = (float)height / SCREEN_HEIGHT;
-
-                    scalePositionsAndSizes(scaleX, scaleY, &player, enemies, ENEMY_COUNT);
-
-                    SCREEN_WIDTH = width;
-                    SCREEN_HEIGHT = height;
+                    // the world keeps its size, only the letterbox around it changes
+                    SDL_GetWindowSize(window, &SCREEN_WIDTH, &SCREEN_HEIGHT);
                 }
+                redraw = true;
             }
 
             if (gameOver && e.type == SDL_MOUSEBUTTONDOWN) {
@@ -479,102 +5932,300 @@ void gameRunning() {
                 running = false;
             }
 
-            if (e.type == SDL_MOUSEBUTTONDOWN) {
-                if (e.button.button == SDL_BUTTON_LEFT) {
-                    int mouseX = e.button.x;
-                    int mouseY = e.button.y;
-                    int numBullets = calculateNumBullets();
-                    shootBullets(player.x + PLAYER_SIZE / 2, player.y + 
-                    PLAYER_SIZE / 2, mouseX, mouseY, numBullets);
+            // Late sampling shows new keys in the frame being drawn, otherwise
+            // the frame of the first tick that takes them does. Replays move
+            // the player from the file, so their keys are not timed.
+            if (isMoveKeyEvent(&e)) {
+                if (inputLatency.lateStamped > 0) {
+                    inputLatency.lateStamped--;
+                } else if (!gameOver && !pipeline.replaying) {
+                    addInputStamp(options.lateInput ? &inputLatency.presenting : &pipeline.moveStamps, eventCounter(&e));
                 }
             }
-            
-        }
 
-        if (gameOver) {
-            int highScore = loadHighScore();
-            if (score > highScore) {
-                saveHighScore(score);
+            // Clicks are fed to the simulation one per tick
+            if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT &&
+                pipeline.queuedShots < MAX_QUEUED_SHOTS) {
+                SimInput shot = { 0, true, 0, 0 };
+                windowToWorld(e.button.x, e.button.y, &shot.fireX, &shot.fireY);
+                pipeline.shotStamps[pipeline.queuedShots] = eventCounter(&e);
+                pipeline.shots[pipeline.queuedShots++] = shot;
             }
+        }
+        PROFILE_END(ZONE_EVENTS);
+        if (pumpTextureCache()) {
+            redraw = true;
+        }
 
-            render(&player, enemies, 0, 0);  // Render the frozen game state
-            renderGameOverText();  
-            SDL_RenderPresent(renderer);
+        if (gameOver) {
+            gameOverFrame(&pipeline.snapshots[pipeline.front], redraw);
+            redraw = false;
+            // the frame still ends, so the profiler and the frame arena keep up
+            PROFILE_END(ZONE_FRAME);
+            Uint64 idleEnd = SDL_GetPerformanceCounter();
+            profileFrameEnd((double)(idleEnd - lastCounter) * 1000.0 / SDL_GetPerformanceFrequency());
+            lastCounter = idleEnd;
+            frameArenaReset();
+            allocCheckFrame();
             continue;  // Skip game logic updates
         }
 
+        Uint64 now = SDL_GetPerformanceCounter();
+        double frameTime = (double)(now - lastCounter) / SDL_GetPerformanceFrequency();
+        lastCounter = now;
+        if (frameTime > MAX_FRAME_TIME) frameTime = MAX_FRAME_TIME;
+        pipeline.accumulator += frameTime;
 
-        Uint32 currenTime = SDL_GetTicks();
-        float deltaTime = (currenTime - lastTime) / 1000.0f;
-        lastTime = currenTime;
+        PROFILE_BEGIN(ZONE_INPUT);
+        pipeline.move = readMoveInput();
+        PROFILE_END(ZONE_INPUT);
+        // what a late-sampled player is moved by, at least a tick so new keys always show
+        int lateTicks = (int)(pipeline.accumulator / simDt);
+        if (lateTicks < 1) lateTicks = 1;
 
-        // Player movement
-        const Uint8* state = SDL_GetKeyboardState(NULL);
-        if (state[SDL_SCANCODE_W]) {
-            player.y -= SPEED * deltaTime;
+        // The next frame is simulated while this one is drawn
+        kickSimFrame(&pipeline);
+        const WorldSnapshot* snapshot = &pipeline.snapshots[pipeline.front];
+        Uint64 renderStart = SDL_GetPerformanceCounter();
+        PROFILE_BEGIN(ZONE_PARTICLES);
+        updateParticles(&particles, snapshot, (float)frameTime);
+        PROFILE_END(ZONE_PARTICLES);
+        playFrameSounds(&audio, snapshot);
+        PROFILE_BEGIN(ZONE_RENDER);
+        bool lateInput = options.lateInput && !pipeline.replaying;
+        float lateReach = lateInput ? SPEED * simDt * lateTicks : 0;
+        if (!renderDirtyFrame(&dirtyRenderer, snapshot, lateReach)) {
+            render(snapshot, !lateInput);
+            renderProfilerOverlay(snapshot);
         }
-        if (state[SDL_SCANCODE_S]) {
-            player.y += SPEED * deltaTime;
+        if (lateInput) {
+            renderLatePlayer(&inputLatency, snapshot, lateTicks);
         }
-        if (state[SDL_SCANCODE_A]) {
-            player.x -= SPEED * deltaTime;
+        PROFILE_END(ZONE_RENDER);
+
+        PROFILE_BEGIN(ZONE_PRESENT);
+        presentFrame();
+        PROFILE_END(ZONE_PRESENT);
+        Uint64 presented = SDL_GetPerformanceCounter();
+        recordInputLatency(&inputLatency, &pipeline.snapshots[pipeline.front].inputs, presented);
+        recordInputLatency(&inputLatency, &inputLatency.presenting, presented);
+        double busyMs = (double)(SDL_GetPerformanceCounter() - renderStart) * 1000.0 / SDL_GetPerformanceFrequency();
+        finishSimFrame(&pipeline);
+        if (pipeline.endedGame) {
+            submitScore(score);
+            playSound(&audio, SOUND_GAME_OVER, 1.0f, 0);
+            redraw = true;
         }
-        if (state[SDL_SCANCODE_D]) {
-            player.x += SPEED * deltaTime;
+        if (pipeline.replaying && replay.gameEnded && !gameOver) {
+            // the recording stopped mid-game, so does the replay
+            menuRunning = true;
+            running = false;
         }
 
-        if (player.x < 0) player.x = 0;
-        if (player.x > SCREEN_WIDTH - PLAYER_SIZE) player.x = SCREEN_WIDTH - PLAYER_SIZE;
-        if (player.y < 0) player.y = 0;
-        if (player.y > SCREEN_HEIGHT - PLAYER_SIZE) player.y = SCREEN_HEIGHT - PLAYER_SIZE;
+        PROFILE_BEGIN(ZONE_WAIT);
+        pacerEndFrame(&framePacer);
+        PROFILE_END(ZONE_WAIT);
+        PROFILE_END(ZONE_FRAME);
+        profileFrameEnd(framePacer.frameMs);
+        updateRenderScale(framePacer.frameMs, busyMs);
 
-        // Revolving red dot
-        angle += 2.0f * PI * deltaTime;
-        float redDotX = player.x + PLAYER_SIZE / 2 + CIRCLE_RADIUS * cos(angle);
-        float redDotY = player.y + PLAYER_SIZE / 2 + CIRCLE_RADIUS * sin(angle);
-        
-        // Check collisions
-        for (int i = 0; i < ENEMY_COUNT; i++) {
-            if (enemies[i].alive && checkCollision(redDotX, redDotY, RED_DOT_RADIUS * 2,
-                enemies[i].x + enemies[i].size / 2, enemies[i].y + enemies[i].size / 2, enemies[i].size)) {
-                enemies[i].alive = false;
-                score++;
-                ENEMY_SPEED+= 1.5;
-            }
-
-            if (enemies[i].alive && checkCollision(player.x + PLAYER_SIZE / 2, player.y + PLAYER_SIZE / 2, PLAYER_SIZE,
-                enemies[i].x + enemies[i].size / 2, enemies[i].y + enemies[i].size / 2, enemies[i].size)) {
-                if (currenTime - lastDamageTime >= damageCooldown){
-                    player.hp--; 
-                    lastDamageTime = currenTime;
-                }
-                if (player.hp <= 0) {
-                    gameOver = true;
-                    break;
+        statsFrames++;
+        if (options.showStats && SDL_GetTicks() - statsTime >= 1000) {
+            allocCheckSkipFrame();
+            char redrawn[32] = "";
+            if (dirtyRenderer.framePixels > 0) {
+                SDL_snprintf(redrawn, sizeof(redrawn), ", %.1f%% redrawn",
+                    dirtyRenderer.redrawnPixels * 100.0 / dirtyRenderer.framePixels);
+                dirtyRenderer.redrawnPixels = dirtyRenderer.framePixels = 0;
+            }
+            char latency[48] = "";
+            float p50, p99;
+            if (inputLatencyPercentiles(&inputLatency, &p50, &p99)) {
+                SDL_snprintf(latency, sizeof(latency), ", input %.1f/%.1f ms p50/p99", p50, p99);
+            }
+            char title[224];
+            SDL_snprintf(title, sizeof(title),
+                "Chase of The Lost - %d FPS, %.2f ms/frame, %.2f ms jitter, %d draw calls, %d enemies, %dx%d render%s%s",
+                statsFrames, framePacer.averageMs, framePacer.jitterMs, lastFrameDrawCalls,
+                pipeline.snapshots[pipeline.front].enemyCount,
+                scene.view.w, scene.view.h, redrawn, latency);
+            SDL_SetWindowTitle(window, title);
+            statsTime = SDL_GetTicks();
+            statsFrames = 0;
+        }
+        frameArenaReset();
+        allocCheckFrame();
+    }
+
+    shutdownSimPipeline(&pipeline);
+    recordGameEnd(&recorder, hashWorld(&world));
+    if (pipeline.replaying) {
+        replayEndGame(&replay, hashWorld(&world), !gameOver && !replay.gameEnded);
+    }
+    freeEnemies(&world.enemies);
+}
+
+// The predicted player over the newest positions received for everything else.
+void captureNetSnapshot(WorldSnapshot* snapshot, const NetClient* client) {
+    const NetGroup* enemies = &client->shown[NET_ENEMIES];
+    const NetGroup* shots = &client->shown[NET_BULLETS];
+    reserveSnapshot(snapshot, enemies->count, shots->count);
+    snapshot->player = client->player;
+    snapshot->redDotX = client->player.x + PLAYER_SIZE / 2 + CIRCLE_RADIUS * cosf(client->angle);
+    snapshot->redDotY = client->player.y + PLAYER_SIZE / 2 + CIRCLE_RADIUS * sinf(client->angle);
+    snapshot->score = client->score;
+    snapshot->enemyCount = enemies->count;
+    for (int i = 0; i < enemies->count; i++) {
+        snapshot->enemyX[i] = dequantizePosition(enemies->x[i]);
+        snapshot->enemyY[i] = dequantizePosition(enemies->y[i]);
+    }
+    snapshot->bulletCount = shots->count;
+    for (int i = 0; i < shots->count; i++) {
+        snapshot->bulletX[i] = dequantizePosition(shots->x[i]);
+        snapshot->bulletY[i] = dequantizePosition(shots->y[i]);
+    }
+    snapshot->kills.count = 0;  // kills and shots are not sent, so only the trail shows
+    snapshot->volleys = 0;
+}
+
+// gameRunning() for a game simulated on a server: every tick sends an input
+// and predicts the player, and each frame draws whatever arrived.
+void netGameRunning() {
+    finishAssetLoading();
+    NetClient* client = startNetClient();
+    if (!client) {
+        running = false;
+        menuRunning = true;
+        return;
+    }
+    WorldSnapshot snapshot = { 0 };
+    reserveSnapshot(&snapshot, NET_MAX_ENTITIES, NET_MAX_ENTITIES);
+    reserveBatch(&spriteBatch, NET_MAX_ENTITIES * 2 + 4);
+    resetParticles(&particles);
+    allocCheckWarmup();
+    SimInput shots[MAX_QUEUED_SHOTS];
+    int queuedShots = 0;
+    bool endedGame = false;
+    double accumulator = 0;
+    Uint64 startCounter = SDL_GetPerformanceCounter();
+    Uint64 lastCounter = startCounter;
+    Uint32 statsTime = SDL_GetTicks();
+    int statsFrames = 0;
+    Uint64 statsBytes = 0;
+
+    while (running) {
+        PROFILE_BEGIN(ZONE_FRAME);
+        PROFILE_BEGIN(ZONE_EVENTS);
+        SDL_Event e;
+        while (SDL_PollEvent(&e)) {
+            quitGame(&e);
+            if (e.type == SDL_KEYDOWN) {
+                fullScreen(&e);
+                if (e.key.keysym.sym == SDLK_F3) {
+                    profiler.overlayVisible = !profiler.overlayVisible;
                 }
+            } else if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                SDL_GetWindowSize(window, &SCREEN_WIDTH, &SCREEN_HEIGHT);
+            }
+
+            if (client->gameOver && e.type == SDL_MOUSEBUTTONDOWN) {
+                menuRunning = true;
+                running = false;
+            } else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT &&
+                queuedShots < MAX_QUEUED_SHOTS) {
+                SimInput shot = { 0, true, 0, 0 };
+                windowToWorld(e.button.x, e.button.y, &shot.fireX, &shot.fireY);
+                shots[queuedShots++] = shot;
             }
         }
+        PROFILE_END(ZONE_EVENTS);
+        pumpTextureCache();
 
-        checkBulletCollisions(enemies);
+        PROFILE_BEGIN(ZONE_SIMULATION);
+        pumpNetClient(client);
+        Uint64 now = SDL_GetPerformanceCounter();
+        double frameTime = (double)(now - lastCounter) / SDL_GetPerformanceFrequency();
+        lastCounter = now;
+        if (frameTime > MAX_FRAME_TIME) frameTime = MAX_FRAME_TIME;
+        accumulator += frameTime;
+        Uint8 move = readMoveInput();
+        while (accumulator >= simDt) {
+            if (client->connected && !client->gameOver) {
+                SimInput input = { move, false, 0, 0 };
+                if (queuedShots > 0) {
+                    input = shots[0];
+                    input.move = move;
+                    memmove(shots, shots + 1, --queuedShots * sizeof(SimInput));
+                }
+                tickNetClient(client, &input);
+            }
+            accumulator -= simDt;
+        }
+        flushNetLink(&client->link);
+        PROFILE_END(ZONE_SIMULATION);
+        if (client->gameOver && !endedGame) {
+            submitScore(client->score);
+            playSound(&audio, SOUND_GAME_OVER, 1.0f, 0);
+            endedGame = true;
+        }
 
-        if (allEnemiesDefeated(enemies)) {
-            for (int i = 0; i < ENEMY_COUNT; i++) {
-                spawnEnemy(&enemies[i]);
+        Uint64 renderStart = SDL_GetPerformanceCounter();
+        captureNetSnapshot(&snapshot, client);
+        PROFILE_BEGIN(ZONE_PARTICLES);
+        updateParticles(&particles, &snapshot, (float)frameTime);
+        PROFILE_END(ZONE_PARTICLES);
+        playFrameSounds(&audio, &snapshot);
+        PROFILE_BEGIN(ZONE_RENDER);
+        if (client->gameOver || !renderDirtyFrame(&dirtyRenderer, &snapshot, 0)) {
+            render(&snapshot, true);
+            renderProfilerOverlay(&snapshot);
+            if (client->gameOver) {
+                renderGameOverText();
             }
         }
+        PROFILE_END(ZONE_RENDER);
 
-        // Enemy chase player
-        updateEnemyPositions(enemies, &player, deltaTime);
+        PROFILE_BEGIN(ZONE_PRESENT);
+        presentFrame();
+        PROFILE_END(ZONE_PRESENT);
+        double busyMs = (double)(SDL_GetPerformanceCounter() - renderStart) * 1000.0 / SDL_GetPerformanceFrequency();
 
-        updateBullets(deltaTime);
+        PROFILE_BEGIN(ZONE_WAIT);
+        pacerEndFrame(&framePacer);
+        PROFILE_END(ZONE_WAIT);
+        PROFILE_END(ZONE_FRAME);
+        profileFrameEnd(framePacer.frameMs);
+        updateRenderScale(framePacer.frameMs, busyMs);
 
-        render(&player, enemies, redDotX, redDotY);
+        statsFrames++;
+        if (options.showStats && SDL_GetTicks() - statsTime >= 1000) {
+            allocCheckSkipFrame();
+            char title[160];
+            SDL_snprintf(title, sizeof(title),
+                "Chase of The Lost - %d FPS, %.2f ms/frame, %.1f KB/s down, %u/%u corrections, %d enemies",
+                statsFrames, framePacer.averageMs, (client->link.bytesReceived - statsBytes) / 1024.0,
+                client->corrections, client->reconciliations, snapshot.enemyCount);
+            SDL_SetWindowTitle(window, title);
+            statsTime = SDL_GetTicks();
+            statsFrames = 0;
+            statsBytes = client->link.bytesReceived;
+        }
+        frameArenaReset();
+        allocCheckFrame();
     }
+
+    freeSnapshot(&snapshot);
+    stopNetClient(client, (double)(SDL_GetPerformanceCounter() - startCounter) / SDL_GetPerformanceFrequency());
 }
 
 void mainMenu() {
     SDL_Rect startButton, optionButton;
     updateButtonPositions(&startButton, &optionButton);
+    Button start;
+    initButton(&start, "Start");
+    setButtonRect(&start, startButton);
+    bool redraw = true;
+    bool firstFrame = true;
 
     while (menuRunning) {
         SDL_Event e;
@@ -587,7 +6238,15 @@ void mainMenu() {
                 SCREEN_WIDTH = e.window.data1;
                 SCREEN_HEIGHT = e.window.data2;
                 updateButtonPositions(&startButton, &optionButton);
-            }            
+                setButtonRect(&start, startButton);
+            }
+            if (e.type == SDL_WINDOWEVENT) {
+                redraw = true;
+            }
+            if (e.type == SDL_RENDER_TARGETS_RESET || e.type == SDL_RENDER_DEVICE_RESET) {
+                start.dirty = true;
+                redraw = true;
+            }
             if (e.type == SDL_MOUSEBUTTONDOWN) {
                 int x, y;
                 SDL_GetMouseState(&x, &y);
@@ -607,16 +6266,169 @@ void mainMenu() {
             }
         }
         
-        SDL_RenderClear(renderer);
-        SDL_RenderCopy(renderer, menuBackgroundTexture, NULL, NULL);
-        renderButton(startButton, "Start");
-        //renderButton(optionButton, "Option");
-        SDL_RenderPresent(renderer);
+        if (!menuRunning) {
+            break;
+        }
+
+        // The menu is static, so it is only redrawn when something happened
+        if (redraw) {
+            SDL_RenderClear(renderer);
+            drawTexture(menuBackgroundTexture, NULL, NULL);
+            renderButton(&start);
+            //renderButton(&option);
+            presentFrame();
+            redraw = false;
+            if (firstFrame && options.showStats) {
+                SDL_Log("First frame after %.1f ms",
+                    (double)(SDL_GetPerformanceCounter() - launchCounter) * 1000.0 / SDL_GetPerformanceFrequency());
+            }
+            firstFrame = false;
+        }
+        frameArenaReset();
+        // the game's textures finish uploading while the menu waits for input
+        pumpAssetUploads();
+        if (pumpTextureCache()) {
+            redraw = true;
+            continue;
+        }
+        SDL_WaitEventTimeout(NULL, IDLE_WAIT_MS);
+    }
+    pacerResume(&framePacer);
+
+    destroyButton(&start);
+}
+
+// "COUNT[:TICKS],..." with one entry per wave, e.g. "10,40:60,200:120".
+void parseWaves(const char* text) {
+    options.waveCount = 0;
+    while (*text && options.waveCount < MAX_WAVE_DEFINITIONS) {
+        char* end;
+        int count = (int)strtol(text, &end, 10);
+        int ticks = WAVE_SPAWN_TICKS;
+        if (*end == ':') {
+            ticks = (int)strtol(end + 1, &end, 10);
+        }
+        if (count > 0) {
+            options.waves[options.waveCount++] = (WaveDefinition){ count, ticks > 0 ? ticks : 1 };
+        }
+        if (*end != ',') {
+            break;
+        }
+        text = end + 1;
+    }
+}
+
+// Returns false, after saying why, when an option's value is unusable.
+bool parseOptions(int argc, char* argv[]) {
+    options.seed = (Uint64)time(NULL);
+    options.ticks = (Uint64)SIM_TICK_RATE * 60 * 60;
+    options.waveSize = ENEMY_COUNT;
+    options.bulletLimit = MAX_BULLETS;
+    options.vsync = true;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            options.headless = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            options.showStats = true;
+        } else if (strcmp(argv[i], "--alloc-check") == 0) {
+            options.allocCheck = true;
+        } else if (strcmp(argv[i], "--verify-grid") == 0) {
+            options.verifyGrid = true;
+        } else if (strcmp(argv[i], "--mute") == 0) {
+            options.mute = true;
+        } else if (strcmp(argv[i], "--full-redraw") == 0) {
+            options.fullRedraw = true;
+        } else if (strcmp(argv[i], "--late-input") == 0) {
+            options.lateInput = true;
+        } else if (strcmp(argv[i], "--no-vsync") == 0) {
+            options.vsync = false;
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            options.fpsCap = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--render-scale") == 0 && i + 1 < argc) {
+            // 0 picks the scale automatically
+            char* end;
+            long percent = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i] || (percent != 0 && (percent < 25 || percent > 100))) {
+                fprintf(stderr, "--render-scale takes 25 to 100 percent, or 0 for automatic, not %s\n", argv[i]);
+                return false;
+            }
+            options.renderScale = (int)percent;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            int threads = atoi(argv[++i]);
+            options.threads = threads > 0 ? threads : 0;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            options.tracePath = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            options.ticks = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--enemies") == 0 && i + 1 < argc) {
+            int count = atoi(argv[++i]);
+            if (count > 0) options.waveSize = count;
+        } else if (strcmp(argv[i], "--waves") == 0 && i + 1 < argc) {
+            parseWaves(argv[++i]);
+        } else if (strcmp(argv[i], "--bullets") == 0 && i + 1 < argc) {
+            int limit = atoi(argv[++i]);
+            if (limit > 0) options.bulletLimit = limit;
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            int port = atoi(argv[++i]);
+            options.serverPort = port > 0 && port < 65536 ? port : 0;
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            options.connectAddress = argv[++i];
+        } else if (strcmp(argv[i], "--net-latency") == 0 && i + 1 < argc) {
+            int ms = atoi(argv[++i]);
+            options.netLatency = ms > 0 ? ms : 0;
+        } else if (strcmp(argv[i], "--net-jitter") == 0 && i + 1 < argc) {
+            int ms = atoi(argv[++i]);
+            options.netJitter = ms > 0 ? ms : 0;
+        } else if (strcmp(argv[i], "--net-loss") == 0 && i + 1 < argc) {
+            float percent = (float)atof(argv[++i]);
+            options.netLoss = percent < 0 ? 0 : percent > 100 ? 100 : percent;
+        } else if (strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc) {
+            int rate = atoi(argv[++i]);
+            if (rate > 0) simTickRate = rate;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            options.recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            options.replayPath = argv[++i];
+        }
     }
+
+    setTickRate(simTickRate);
+    selectEnemyKernel();
+    selectParticleKernel();
+    return true;
 }
 
-int WinMain(int argc, char* argv[]) {
+#ifndef COTL_NO_MAIN
+int main(int argc, char* argv[]) {
+    installAllocCounter();
+    if (!parseOptions(argc, argv)) {
+        return 2;
+    }
+    if ((options.replayPath && !loadReplay(&replay, options.replayPath)) ||
+        (options.recordPath && !startRecording(&recorder, options.recordPath))) {
+        return 2;
+    }
+    initJobSystem(options.threads);
+    if (options.serverPort > 0 || options.headless) {
+        int status = options.serverPort > 0 ? runServer() :
+            options.connectAddress ? runNetClient() : options.replayPath ? runReplay() :
+            options.verifyGrid ? runGridCheck() : runHeadless();
+        shutdownJobSystem();
+        stopRecording(&recorder);
+        freeReplay(&replay);
+        return status != 0 ? status : allocCheckReport();
+    }
+
     init();
+    Rng sessionRng = { options.seed };
+    if (replay.playing) {
+        // straight into the first recorded game
+        menuRunning = false;
+        running = true;
+    }
     
     while (quit==false)
     {
@@ -624,14 +6436,24 @@ int WinMain(int argc, char* argv[]) {
             mainMenu();
         }
         if(running==true){
-            gameRunning();
-            score = 0;
-            ENEMY_SPEED= INITIAL_ENEMY_SPEED; 
-            gameOver = false;  
+            if (options.connectAddress) {
+                netGameRunning();
+            } else {
+                gameRunning(&sessionRng);
+            }
         }     
     }
     
 
+    float p50, p99;
+    if (options.showStats && inputLatencyPercentiles(&inputLatency, &p50, &p99)) {
+        printf("input_events=%llu input_latency_p50_ms=%.2f input_latency_p99_ms=%.2f late_input=%s\n",
+            (unsigned long long)inputLatency.total, p50, p99, options.lateInput ? "on" : "off");
+    }
     cleanup();
-    return 0;
-} 
\ No newline at end of file
+    shutdownJobSystem();
+    stopRecording(&recorder);
+    freeReplay(&replay);
+    return allocCheckReport();
+}
+#endif
@@ -0,0 +1,443 @@
+// Benchmark runner for Chase of The Lost. The game is compiled in with its
+// main() left out and the simulation is driven through scripted scenarios.
+// Scenarios that draw use a hidden window on SDL's dummy video driver, so no
+// video device is needed. Results are written as JSON and can be compared
+// against a stored baseline.
+#define COTL_NO_MAIN
+#include "COTL.c"
+
+#define BENCH_DEFAULT_TICKS 600
+#define BENCH_WARMUP_TICKS 60
+#define BENCH_DEFAULT_SEED 1
+#define BENCH_DEFAULT_THRESHOLD 10.0
+#define BENCH_INVULNERABLE_HP (1 << 30)
+
+typedef struct {
+    const char* name;
+    int enemies;
+    int bulletLimit;
+    bool invulnerable;  // keeps the wave at full size for the whole run
+    bool fullPower;     // starts at a score that fires the widest spread
+    bool resizeStorm;   // resizes the window and draws a frame every tick
+    bool idle;          // game over screen, woken and redrawn by a window event every tick; nothing simulates
+    bool particles;     // a frame of kill bursts per tick through the particle system, nothing simulates
+} Scenario;
+
+typedef struct {
+    const char* name;
+    Uint64 ticks;
+    double ticksPerSec;
+    double p50Us;
+    double p99Us;
+    double maxUs;
+    double allocsPerTick;
+    double bytesPerTick;
+    double framesPerSec;
+    bool draws;
+    Uint64 hash;
+    bool hashed;  // false when the scenario leaves no state worth hashing
+} BenchResult;
+
+Scenario scenarios[] = {
+    { "enemies-10",     10,     MAX_BULLETS, false, false, false, false, false },
+    { "enemies-1k",     1000,   MAX_BULLETS, true,  false, false, false, false },
+    { "enemies-10k",    10000,  MAX_BULLETS, true,  false, false, false, false },
+    { "enemies-100k",   100000, MAX_BULLETS, true,  false, false, false, false },
+    { "max-bullets",    1000,   4096,        true,  true,  false, false, false },
+    { "resize-storm",   1000,   MAX_BULLETS, true,  false, true,  false, false },
+    { "gameover-idle",  1000,   MAX_BULLETS, false, false, false, true,  false },
+    { "particles",      10,     MAX_BULLETS, false, false, false, false, true  },
+};
+#define SCENARIO_COUNT (int)(sizeof(scenarios) / sizeof(scenarios[0]))
+
+WorldSnapshot particleFrame;
+WorldSnapshot drawnFrame;
+Uint64 framesDrawn;
+
+SDL_Point stormSizes[] = { { 800, 600 }, { 1280, 720 }, { 1920, 1080 }, { 640, 480 } };
+
+// Count and positions of every layer, the state the particles scenario drives.
+Uint64 hashParticles(const ParticleSystem* system) {
+    Uint64 hash = 0xCBF29CE484222325ull;
+    for (int i = 0; i < PARTICLE_LAYER_COUNT; i++) {
+        const ParticlePool* pool = &system->layers[i];
+        hash = hashBytes(hash, &pool->count, sizeof(int));
+        hash = hashBytes(hash, pool->x, pool->count * sizeof(float));
+        hash = hashBytes(hash, pool->y, pool->count * sizeof(float));
+    }
+    return hash;
+}
+
+int compareUint64(const void* a, const void* b) {
+    Uint64 x = *(const Uint64*)a;
+    Uint64 y = *(const Uint64*)b;
+    return (x > y) - (x < y);
+}
+
+// Opens the hidden window the first time a scenario draws. Frames go
+// through the scene target, the path an accelerated renderer takes.
+bool openBenchWindow() {
+    if (window) {
+        return true;
+    }
+    if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0 || TTF_Init() != 0) {
+        fprintf(stderr, "Could not start video: %s\n", SDL_GetError());
+        return false;
+    }
+    window = SDL_CreateWindow("cotl_bench", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+        INITIAL_SCREEN_WIDTH, INITIAL_SCREEN_HEIGHT, SDL_WINDOW_HIDDEN | SDL_WINDOW_RESIZABLE);
+    renderer = window ? SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE) : NULL;
+    if (!renderer) {
+        fprintf(stderr, "Could not create a window: %s\n", SDL_GetError());
+        return false;
+    }
+    options.fullRedraw = true;
+    initRendering();
+    finishAssetLoading();
+    initScene();
+    return true;
+}
+
+void closeBenchWindow() {
+    if (!window) {
+        return;
+    }
+    shutdownRendering();
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    renderer = NULL;
+    window = NULL;
+    TTF_Quit();
+}
+
+// What a resize event costs in game: the letterbox follows the window, the
+// scene target is remade, the backgrounds are rescaled to their new size
+// and a frame is drawn at it.
+void resizeWindow(SDL_Point size, const World* world) {
+    SDL_SetWindowSize(window, size.x, size.y);
+    SDL_GetWindowSize(window, &SCREEN_WIDTH, &SCREEN_HEIGHT);
+    pumpTextureCache();
+    // the rescale runs on a worker; waiting for it charges every resize its own
+    while (textureCache.worker && !SDL_AtomicGet(&textureCache.done)) {
+        SDL_FlushEvents(SDL_FIRSTEVENT, SDL_LASTEVENT);
+        SDL_WaitEventTimeout(NULL, 1);
+    }
+    pumpTextureCache();
+    SDL_FlushEvents(SDL_FIRSTEVENT, SDL_LASTEVENT);
+    captureSnapshot(&drawnFrame, world);
+    render(&drawnFrame, true);
+    presentFrame();
+    framesDrawn++;
+}
+
+void startScenario(const Scenario* scenario, World* world, Rng* sessionRng) {
+    initWorld(world, rngNext(sessionRng));
+    if (scenario->invulnerable) {
+        world->player.hp = BENCH_INVULNERABLE_HP;
+    }
+    if (scenario->fullPower) {
+        score = 100;
+    }
+    if (scenario->idle) {
+        gameOver = true;
+        captureSnapshot(&drawnFrame, world);
+    }
+}
+
+void benchTick(const Scenario* scenario, World* world, Rng* botRng, Rng* sessionRng, SimInput* input, Uint64 tick) {
+    if (scenario->idle) {
+        // what gameRunning does once the game is over; the event queued here
+        // ends the wait at once and has the next tick redraw
+        bool redraw = false;
+        SDL_Event e;
+        while (SDL_PollEvent(&e)) {
+            redraw = redraw || e.type == SDL_WINDOWEVENT;
+        }
+        SDL_Event exposed = { .type = SDL_WINDOWEVENT };
+        exposed.window.event = SDL_WINDOWEVENT_EXPOSED;
+        SDL_PushEvent(&exposed);
+        gameOverFrame(&drawnFrame, redraw);
+        framesDrawn += redraw;
+        return;
+    }
+    if (scenario->particles) {
+        // more kills than the budget covers, so every tick emits the most it can
+        particleFrame.kills.count = MAX_KILL_EVENTS;
+        for (int i = 0; i < MAX_KILL_EVENTS; i++) {
+            particleFrame.kills.x[i] = rngUnit(botRng) * WORLD_WIDTH;
+            particleFrame.kills.y[i] = rngUnit(botRng) * WORLD_HEIGHT;
+        }
+        particleFrame.redDotX = world->redDotX;
+        particleFrame.redDotY = world->redDotY;
+        updateParticles(&particles, &particleFrame, simDt);
+        return;
+    }
+    if (scenario->resizeStorm) {
+        resizeWindow(stormSizes[tick % (sizeof(stormSizes) / sizeof(stormSizes[0]))], world);
+    }
+    botInput(world, botRng, input);
+    if (scenario->fullPower && world->enemies.count > 0) {
+        // fire every tick, sweeping the aim around the player
+        float angle = tick * 0.1f;
+        input->fire = true;
+        input->fireX = world->player.x + cosf(angle) * 100.0f;
+        input->fireY = world->player.y + sinf(angle) * 100.0f;
+    }
+    simStep(world, input);
+    if (gameOver) {
+        startScenario(scenario, world, sessionRng);
+    }
+}
+
+// False, after saying why, when there is no room for the tick samples or no
+// window to draw in.
+bool runScenario(const Scenario* scenario, Uint64 ticks, Uint64 seed, BenchResult* result) {
+    Rng sessionRng = { seed };
+    Rng botRng = { seed ^ 0x9E3779B97F4A7C15ull };
+    World world = { 0 };
+    SimInput input = { 0 };
+    Uint64* samples = ticks <= SIZE_MAX / sizeof(Uint64) ? malloc(ticks * sizeof(Uint64)) : NULL;
+    if (!samples) {
+        fprintf(stderr, "Could not allocate %llu tick samples\n", (unsigned long long)ticks);
+        return false;
+    }
+    if ((scenario->resizeStorm || scenario->idle) && !openBenchWindow()) {
+        free(samples);
+        return false;
+    }
+
+    options.waveSize = scenario->enemies;
+    options.bulletLimit = scenario->bulletLimit;
+    startScenario(scenario, &world, &sessionRng);
+    if (scenario->particles) {
+        initParticles(&particles);
+        resetParticles(&particles);
+    }
+
+    for (Uint64 tick = 0; tick < BENCH_WARMUP_TICKS; tick++) {
+        benchTick(scenario, &world, &botRng, &sessionRng, &input, tick);
+    }
+
+    int allocStart = allocationCount();
+    Uint32 bytesStart = (Uint32)SDL_AtomicGet(&allocCounter.bytes);
+    framesDrawn = 0;
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (Uint64 tick = 0; tick < ticks; tick++) {
+        Uint64 tickStart = SDL_GetPerformanceCounter();
+        benchTick(scenario, &world, &botRng, &sessionRng, &input, BENCH_WARMUP_TICKS + tick);
+        samples[tick] = SDL_GetPerformanceCounter() - tickStart;
+    }
+    Uint64 elapsed = SDL_GetPerformanceCounter() - start;
+
+    double toUs = 1000000.0 / SDL_GetPerformanceFrequency();
+    qsort(samples, ticks, sizeof(Uint64), compareUint64);
+    result->name = scenario->name;
+    result->ticks = ticks;
+    result->ticksPerSec = elapsed > 0 ? ticks * (double)SDL_GetPerformanceFrequency() / elapsed : 0.0;
+    result->p50Us = samples[ticks / 2] * toUs;
+    result->p99Us = samples[ticks * 99 / 100] * toUs;
+    result->maxUs = samples[ticks - 1] * toUs;
+    result->allocsPerTick = (double)(allocationCount() - allocStart) / ticks;
+    result->bytesPerTick = (double)((Uint32)SDL_AtomicGet(&allocCounter.bytes) - bytesStart) / ticks;
+    result->draws = scenario->resizeStorm || scenario->idle;
+    result->framesPerSec = elapsed > 0 ? framesDrawn * (double)SDL_GetPerformanceFrequency() / elapsed : 0.0;
+    result->hashed = !scenario->idle;
+    result->hash = scenario->particles ? hashParticles(&particles) : hashWorld(&world);
+
+    free(samples);
+    freeEnemies(&world.enemies);
+    gameOver = false;
+    return true;
+}
+
+void writeResults(FILE* file, const BenchResult results[], int count, Uint64 seed) {
+    fprintf(file, "{\n  \"seed\": %llu,\n  \"kernel\": \"%s\",\n  \"threads\": %d,\n  \"scenarios\": [\n",
+        (unsigned long long)seed,
+        advanceEnemies == advanceEnemiesScalar ? "scalar" : advanceEnemies == advanceEnemiesSSE2 ? "sse2" : "avx2",
+        jobs.workerCount + 1);
+    for (int i = 0; i < count; i++) {
+        const BenchResult* r = &results[i];
+        fprintf(file,
+            "    {\"name\": \"%s\", \"ticks\": %llu, \"ticks_per_sec\": %.1f, \"p50_us\": %.3f, \"p99_us\": %.3f, "
+            "\"max_us\": %.3f, \"allocs_per_tick\": %.4f, \"bytes_per_tick\": %.1f, \"frames_per_sec\": ",
+            r->name, (unsigned long long)r->ticks, r->ticksPerSec, r->p50Us, r->p99Us, r->maxUs,
+            r->allocsPerTick, r->bytesPerTick);
+        if (r->draws) {
+            fprintf(file, "%.1f, \"hash\": ", r->framesPerSec);
+        } else {
+            fprintf(file, "null, \"hash\": ");
+        }
+        if (r->hashed) {
+            fprintf(file, "\"%016llx\"}%s\n", (unsigned long long)r->hash, i + 1 < count ? "," : "");
+        } else {
+            fprintf(file, "null}%s\n", i + 1 < count ? "," : "");
+        }
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+char* readTextFile(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    if (!text) {
+        fclose(file);
+        return NULL;
+    }
+    size_t read = fread(text, 1, size, file);
+    text[read] = '\0';
+    fclose(file);
+    return text;
+}
+
+// Finds a number field inside one scenario object of a results file. This
+// only has to read what writeResults produces, so it is a plain text search.
+bool findBaselineField(const char* baseline, const char* name, const char* field, double* value) {
+    char key[128];
+    SDL_snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+    const char* object = strstr(baseline, key);
+    if (!object) {
+        return false;
+    }
+    const char* objectEnd = strchr(object, '}');
+    SDL_snprintf(key, sizeof(key), "\"%s\": ", field);
+    const char* found = strstr(object, key);
+    if (!found || (objectEnd && found > objectEnd)) {
+        return false;
+    }
+    *value = strtod(found + strlen(key), NULL);
+    return true;
+}
+
+// Throughput and p99 regress when they are worse than the baseline by more
+// than the threshold. Allocations are deterministic, so any increase counts.
+int compareResults(const BenchResult results[], int count, const char* baselinePath, double threshold) {
+    char* baseline = readTextFile(baselinePath);
+    if (!baseline) {
+        fprintf(stderr, "Could not read baseline %s\n", baselinePath);
+        return 2;
+    }
+
+    int regressions = 0;
+    fprintf(stderr, "%-16s %12s %12s %8s %10s %10s %8s %8s %8s\n",
+        "scenario", "ticks/s", "base", "delta", "p99 us", "base", "delta", "allocs", "base");
+    for (int i = 0; i < count; i++) {
+        const BenchResult* r = &results[i];
+        double baseRate, baseP99, baseAllocs;
+        if (!findBaselineField(baseline, r->name, "ticks_per_sec", &baseRate) ||
+            !findBaselineField(baseline, r->name, "p99_us", &baseP99) ||
+            !findBaselineField(baseline, r->name, "allocs_per_tick", &baseAllocs)) {
+            fprintf(stderr, "%-16s not in baseline\n", r->name);
+            continue;
+        }
+        double rateDelta = baseRate > 0 ? (r->ticksPerSec - baseRate) * 100.0 / baseRate : 0.0;
+        double p99Delta = baseP99 > 0 ? (r->p99Us - baseP99) * 100.0 / baseP99 : 0.0;
+        bool regressed = rateDelta < -threshold || p99Delta > threshold || r->allocsPerTick > baseAllocs + 0.0001;
+        regressions += regressed;
+        fprintf(stderr, "%-16s %12.0f %12.0f %+7.1f%% %10.2f %10.2f %+7.1f%% %8.3f %8.3f%s\n",
+            r->name, r->ticksPerSec, baseRate, rateDelta, r->p99Us, baseP99, p99Delta,
+            r->allocsPerTick, baseAllocs, regressed ? "  REGRESSION" : "");
+    }
+    free(baseline);
+
+    if (regressions > 0) {
+        fprintf(stderr, "%d scenario(s) regressed by more than %.1f%%\n", regressions, threshold);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    Uint64 ticks = BENCH_DEFAULT_TICKS;
+    Uint64 seed = BENCH_DEFAULT_SEED;
+    double threshold = BENCH_DEFAULT_THRESHOLD;
+    const char* only = NULL;
+    const char* outPath = NULL;
+    const char* baselinePath = NULL;
+
+    // --tick-rate and the other shared flags are read by the game's parser
+    if (!parseOptions(argc, argv)) {
+        return 2;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            ticks = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--scenario") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--list") == 0) {
+            for (int j = 0; j < SCENARIO_COUNT; j++) {
+                printf("%s\n", scenarios[j].name);
+            }
+            return 0;
+        }
+    }
+    if (ticks == 0) {
+        ticks = 1;
+    }
+
+    installAllocCounter();
+    SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+    if (SDL_Init(SDL_INIT_EVENTS) != 0) {
+        fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
+        return 2;
+    }
+    initJobSystem(options.threads);
+
+    BenchResult results[SCENARIO_COUNT];
+    int count = 0;
+    for (int i = 0; i < SCENARIO_COUNT; i++) {
+        if (only && strcmp(only, scenarios[i].name) != 0) {
+            continue;
+        }
+        if (!runScenario(&scenarios[i], ticks, seed, &results[count])) {
+            closeBenchWindow();
+            shutdownJobSystem();
+            SDL_Quit();
+            return 2;
+        }
+        fprintf(stderr, "%-16s %10.0f ticks/s  p50 %8.2f us  p99 %8.2f us  %.3f allocs/tick\n",
+            results[count].name, results[count].ticksPerSec, results[count].p50Us,
+            results[count].p99Us, results[count].allocsPerTick);
+        count++;
+    }
+    if (count == 0) {
+        fprintf(stderr, "Unknown scenario %s, see --list\n", only);
+        shutdownJobSystem();
+        SDL_Quit();
+        return 2;
+    }
+    closeBenchWindow();
+    freeBullets(&bullets);
+    freeParticles(&particles);
+    freeBatch(&spriteBatch);
+
+    FILE* out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Could not write %s\n", outPath);
+        shutdownJobSystem();
+        SDL_Quit();
+        return 2;
+    }
+    writeResults(out, results, count, seed);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    int status = baselinePath ? compareResults(results, count, baselinePath, threshold) : 0;
+    shutdownJobSystem();
+    SDL_Quit();
+    return status;
+}
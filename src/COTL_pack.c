@@ -0,0 +1,240 @@
+// Offline asset packer for Chase of The Lost. Decodes the images under
+// assets/ once, scales the sprites to the size they are drawn at and writes
+// them as RGBA32, LZ4-compressed where that helps, together with the font
+// into the single bundle the game memory-maps at startup.
+#define COTL_NO_MAIN
+#include "COTL.c"
+
+#define LZ4_HASH_BITS 16
+#define LZ4_LAST_LITERALS 5   // a block always ends with at least this many literals
+#define LZ4_MATCH_LIMIT 12    // and no match starts closer than this to its end
+#define LZ4_MAX_OFFSET 65535
+
+typedef struct {
+    BundleEntry entry;
+    Uint8* data;
+} PackedEntry;
+
+size_t lz4Bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+Uint8* writeLength(Uint8* out, size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (Uint8)length;
+    return out;
+}
+
+Uint8* writeSequence(Uint8* out, const Uint8* literals, size_t literalCount, size_t offset, size_t matchLength) {
+    Uint8* token = out++;
+    *token = (Uint8)((literalCount >= 15 ? 15 : literalCount) << 4);
+    if (literalCount >= 15) {
+        out = writeLength(out, literalCount - 15);
+    }
+    memcpy(out, literals, literalCount);
+    out += literalCount;
+    if (matchLength == 0) {
+        return out;  // last sequence: literals only
+    }
+    *out++ = (Uint8)offset;
+    *out++ = (Uint8)(offset >> 8);
+    matchLength -= LZ4_MIN_MATCH;
+    *token |= (Uint8)(matchLength >= 15 ? 15 : matchLength);
+    if (matchLength >= 15) {
+        out = writeLength(out, matchLength - 15);
+    }
+    return out;
+}
+
+// Greedy single-probe LZ4 block compressor. It favours a simple, exact
+// format over ratio; dst must hold lz4Bound(size) bytes.
+size_t lz4Compress(const Uint8* src, size_t size, Uint8* dst) {
+    Sint64* table = malloc(sizeof(Sint64) << LZ4_HASH_BITS);
+    for (size_t i = 0; i < (size_t)1 << LZ4_HASH_BITS; i++) {
+        table[i] = -1;
+    }
+
+    Uint8* out = dst;
+    size_t anchor = 0;
+    size_t i = 0;
+    while (size > LZ4_MATCH_LIMIT && i < size - LZ4_MATCH_LIMIT) {
+        Uint32 sequence;
+        memcpy(&sequence, src + i, 4);
+        Uint32 hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+        Sint64 candidate = table[hash];
+        table[hash] = (Sint64)i;
+        if (candidate < 0 || i - candidate > LZ4_MAX_OFFSET || memcmp(src + candidate, src + i, 4) != 0) {
+            i++;
+            continue;
+        }
+
+        size_t end = i + LZ4_MIN_MATCH;
+        while (end < size - LZ4_LAST_LITERALS && src[end] == src[end - (i - candidate)]) {
+            end++;
+        }
+        out = writeSequence(out, src + anchor, i - anchor, i - candidate, end - i);
+        i = anchor = end;
+    }
+    out = writeSequence(out, src + anchor, size - anchor, 0, 0);
+
+    free(table);
+    return (size_t)(out - dst);
+}
+
+// Stores data compressed unless that would not make it smaller.
+void packData(PackedEntry* packed, const Uint8* data, size_t size, bool compress) {
+    packed->entry.rawSize = size;
+    packed->entry.compression = BUNDLE_RAW;
+    if (compress) {
+        Uint8* compressed = malloc(lz4Bound(size));
+        size_t compressedSize = lz4Compress(data, size, compressed);
+        if (compressedSize < size) {
+            packed->data = compressed;
+            packed->entry.storedSize = compressedSize;
+            packed->entry.compression = BUNDLE_LZ4;
+            return;
+        }
+        free(compressed);
+    }
+    packed->data = malloc(size);
+    memcpy(packed->data, data, size);
+    packed->entry.storedSize = size;
+}
+
+bool packImage(PackedEntry* packed, const char* assetDir, int asset, bool compress) {
+    char path[512];
+    SDL_snprintf(path, sizeof(path), "%s/images/%s.png", assetDir, assetNames[asset]);
+    SDL_Surface* loaded = IMG_Load(path);
+    if (!loaded) {
+        fprintf(stderr, "Could not load %s: %s\n", path, IMG_GetError());
+        return false;
+    }
+    SDL_Point size = assetPackSizes[asset];
+    SDL_Surface* image = size.x > 0 ? resampleImage(loaded, size.x, size.y) :
+        SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_FreeSurface(loaded);
+    if (!image) {
+        return false;
+    }
+
+    // rows are stored packed, without the surface's pitch padding
+    size_t rowSize = (size_t)image->w * 4;
+    Uint8* pixels = malloc(rowSize * image->h);
+    for (int y = 0; y < image->h; y++) {
+        memcpy(pixels + y * rowSize, (Uint8*)image->pixels + y * image->pitch, rowSize);
+    }
+    SDL_strlcpy(packed->entry.name, assetNames[asset], BUNDLE_NAME_LENGTH);
+    packed->entry.width = (Uint32)image->w;
+    packed->entry.height = (Uint32)image->h;
+    packData(packed, pixels, rowSize * image->h, compress);
+    free(pixels);
+    SDL_FreeSurface(image);
+    return true;
+}
+
+// Fonts stay uncompressed so the game can open them in place.
+bool packFont(PackedEntry* packed, const char* assetDir) {
+    char path[512];
+    SDL_snprintf(path, sizeof(path), "%s/fonts/VCR_OSD_MONO.ttf", assetDir);
+    size_t size;
+    void* data = SDL_LoadFile(path, &size);
+    if (!data) {
+        fprintf(stderr, "Could not load %s: %s\n", path, SDL_GetError());
+        return false;
+    }
+    SDL_strlcpy(packed->entry.name, BUNDLE_FONT_NAME, BUNDLE_NAME_LENGTH);
+    packData(packed, data, size, false);
+    SDL_free(data);
+    return true;
+}
+
+bool writeBundle(const char* path, PackedEntry packed[], int count) {
+    Uint8 header[BUNDLE_HEADER_SIZE + BUNDLE_MAX_ENTRIES * BUNDLE_ENTRY_SIZE] = { 0 };
+    Uint64 offset = BUNDLE_HEADER_SIZE + count * BUNDLE_ENTRY_SIZE;
+    writeU32(header, BUNDLE_MAGIC);
+    writeU32(header + 4, BUNDLE_VERSION);
+    writeU32(header + 8, (Uint32)count);
+    for (int i = 0; i < count; i++) {
+        BundleEntry* entry = &packed[i].entry;
+        offset = (offset + BUNDLE_ALIGNMENT - 1) & ~(Uint64)(BUNDLE_ALIGNMENT - 1);
+        entry->offset = offset;
+        offset += entry->storedSize;
+
+        Uint8* p = header + BUNDLE_HEADER_SIZE + i * BUNDLE_ENTRY_SIZE;
+        memcpy(p, entry->name, BUNDLE_NAME_LENGTH);
+        writeU32(p + 32, entry->width);
+        writeU32(p + 36, entry->height);
+        writeU32(p + 40, entry->compression);
+        writeU64(p + 48, entry->offset);
+        writeU64(p + 56, entry->storedSize);
+        writeU64(p + 64, entry->rawSize);
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not write %s\n", path);
+        return false;
+    }
+    bool written = fwrite(header, 1, BUNDLE_HEADER_SIZE + count * BUNDLE_ENTRY_SIZE, file) ==
+        (size_t)(BUNDLE_HEADER_SIZE + count * BUNDLE_ENTRY_SIZE);
+    static const Uint8 padding[BUNDLE_ALIGNMENT] = { 0 };
+    for (int i = 0; i < count && written; i++) {
+        long position = ftell(file);
+        size_t pad = (size_t)(packed[i].entry.offset - (Uint64)position);
+        written = fwrite(padding, 1, pad, file) == pad &&
+            fwrite(packed[i].data, 1, packed[i].entry.storedSize, file) == packed[i].entry.storedSize;
+    }
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        fprintf(stderr, "Could not write %s\n", path);
+        remove(path);
+    }
+    return written;
+}
+
+int main(int argc, char* argv[]) {
+    const char* assetDir = "./assets";
+    const char* outPath = BUNDLE_FILE;
+    bool compress = true;
+    int positional = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--raw") == 0) {
+            compress = false;
+        } else if (positional == 0) {
+            assetDir = argv[i];
+            positional++;
+        } else {
+            outPath = argv[i];
+        }
+    }
+
+    SDL_Init(0);
+    IMG_Init(IMG_INIT_PNG | IMG_INIT_WEBP);
+
+    PackedEntry packed[ASSET_COUNT + 1] = { 0 };
+    int count = 0;
+    bool ok = true;
+    for (int i = 0; i < ASSET_COUNT && ok; i++) {
+        ok = packImage(&packed[count++], assetDir, i, compress);
+    }
+    ok = ok && packFont(&packed[count++], assetDir);
+    ok = ok && writeBundle(outPath, packed, count);
+
+    for (int i = 0; i < count; i++) {
+        if (ok) {
+            const BundleEntry* entry = &packed[i].entry;
+            printf("%-10s %5ux%-5u %10llu -> %10llu bytes %s\n", entry->name, entry->width, entry->height,
+                (unsigned long long)entry->rawSize, (unsigned long long)entry->storedSize,
+                entry->compression == BUNDLE_LZ4 ? "lz4" : "raw");
+        }
+        free(packed[i].data);
+    }
+
+    IMG_Quit();
+    SDL_Quit();
+    return ok ? 0 : 1;
+}